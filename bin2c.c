@@ -11,19 +11,66 @@
  * A few more enhancements were made by Thiadmer Riemersma (thiadmer@compuphase.com),
  * and also donated to the public domain.
  */
+#define _FILE_OFFSET_BITS 64    /* 64-bit file sizes on 32-bit systems */
+#define _GNU_SOURCE             /* for O_DIRECT on Linux */
 
 #include <assert.h>
 #include <ctype.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
 
 #ifdef USE_BZ2
 #include <bzlib.h>
 #endif
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef USE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#if (defined __GNUC__ || defined __clang__) && (defined __x86_64__ || defined __i386__)
+#   include <tmmintrin.h>
+#   define HAVE_SSSE3
+#   define TARGET_SSSE3 __attribute__((target("ssse3")))
+#elif defined _MSC_VER && (defined _M_X64 || defined _M_IX86)
+#   include <intrin.h>
+#   include <tmmintrin.h>
+#   define HAVE_SSSE3
+#   define TARGET_SSSE3
+#elif defined __aarch64__ || defined _M_ARM64
+#   include <arm_neon.h>
+#   define HAVE_NEON
+#endif
+
+#if defined _WIN32
+#   include <windows.h>
+#   include <fcntl.h>
+#   include <io.h>
+#   include <process.h>
+#   include <psapi.h>
+#   define HAVE_MMAP
+#elif defined __unix__ || defined __APPLE__
+#   include <sys/mman.h>
+#   include <sys/resource.h>
+#   include <sys/stat.h>
+#   include <dirent.h>
+#   include <fcntl.h>
+#   include <pthread.h>
+#   include <unistd.h>
+#   define HAVE_MMAP
+#endif
 
 #if !defined _MAX_PATH
 #   if defined MAX_PATH
@@ -35,10 +82,48 @@
 #   endif
 #endif
 
+#if defined _MSC_VER
+#   define THREAD_LOCAL __declspec(thread)
+#elif defined __GNUC__ || defined __clang__
+#   define THREAD_LOCAL __thread
+#else
+#   define THREAD_LOCAL _Thread_local
+#endif
+
+/* In worker mode (option --worker), an error ends the request instead of the
+   process: fatal() stores the message and jumps back to the thread that runs
+   the request. The pointer is only set while a thread runs a request, or while
+   it runs a compression job (which is raised again by the thread that owns
+   the job). */
+typedef struct tagFAILURE {
+    jmp_buf env;
+    char message[512];
+    bool worker;                /* whether the thread runs a request of a worker */
+} FAILURE;
+
+static THREAD_LOCAL FAILURE *failure;
+
+/* in_request() returns whether the thread runs a request in worker mode */
+static bool in_request(void)
+{
+    return failure != NULL && failure->worker;
+}
+
+/* release_files() closes the inputs and outputs that the thread has open (it
+   is defined further down, with the INPUT and OUTPUT types) */
+static void release_files(void);
+
 static void fatal(const char *msg, ...)
 {
     va_list ap;
     va_start(ap, msg);
+    if (failure != NULL) {
+        vsnprintf(failure->message, sizeof failure->message, msg, ap);
+        va_end(ap);
+        /* the jump skips the code that would close the files */
+        release_files();
+        longjmp(failure->env, 1);
+    }
     fprintf(stderr, "ERROR: ");
     vfprintf(stderr, msg, ap);
     fprintf(stderr, "\n");
@@ -47,267 +132,5403 @@ static void fatal(const char *msg, ...)
 
 static void about(const char *arg)
 {
+    if (in_request()) {
+        /* a request of a worker cannot ask for help, but it can be invalid */
+        if (arg != NULL)
+            fatal("Invalid option '%s'.", arg);
+        fatal("No input file. Use 'bin2c --help' for usage information.");
+    }
     if (arg == NULL) {
         fprintf(stderr, "Bin2C converts a binary file to a C array declaration.\n\n"
-                        "Usage: bin2c input_file [output_file] [options]\n\n"
+                        "Usage: bin2c input_file [output_file] [options]\n"
+                        "       bin2c input_file [input_file...] [@list_file...] -o output_file [options]\n"
+                        "       bin2c @list_file [@list_file...] [options]\n\n"
                         "Command line arguments:\n"
-                        "  input_file         The binary file to convert.\n"
-                        "  output_file        The name of the generated file with the array declaration.\n\n");
+                        "  input_file         The binary file to convert (\"-\" for standard input).\n"
+                        "  output_file        The name of the generated file with the array declaration\n"
+                        "                     (\"-\" for standard output).\n"
+                        "  list_file          A file with an input file on each line, optionally followed\n"
+                        "                     by options for that input file.\n\n");
     } else {
         fprintf(stderr, "ERROR: Invalid option '%s'.\n\n", arg);
     }
     fprintf(stderr, "Options:\n"
                     "  -a|--append         Append to the output file instead of overwriting.\n"
-                    "  -b|--bits <number>  Set the width of the array elements (default = 8).\n"
+                    "  --accessor          Add functions that decompress the data once (thread-\n"
+                    "                      safe) and that read it sequentially, for each array;\n"
+                    "                      with --blocksize, also a cache for random access.\n"
+                    "  --align <number>    Align the array on a multiple of this number of bytes.\n"
+                    "  --base <file>       Store the data as a patch against this file, with a\n"
+                    "                      function that applies the patch.\n"
+                    "  -b|--bits <number>  Set the width of the array elements: 8, 16, 32 or 64\n"
+                    "                      (default = 8).\n"
+                    "  --blocksize <size>  Compress the data in independent blocks of this size\n"
+                    "                      (suffix 'k' for kilobytes), with an index of the\n"
+                    "                      blocks, for random access.\n"
+                    "  --bundle            Pack all input files (and the files in input directories)\n"
+                    "                      in a single array, with a directory and a function to\n"
+                    "                      look up a file by its path; requires -o.\n"
+                    "  -c|--compress <name> Compress the data with the codec: none, bz2, deflate,\n"
+                    "                      lz4 or zstd (only codecs that are compiled in are\n"
+                    "                      available).\n"
+                    "  --cpp               Declare the data as C++17 'inline constexpr' (with\n"
+                    "                      std::array for uncompressed arrays).\n"
+                    "  --dedup             Store files with the same contents only once (the\n"
+                    "                      later files become aliases).\n"
                     "  -d|--define         Declare the array size as a #define, instead of a\n"
                     "                      'const int'.\n"
+                    "  --direct            Write the output file without the cache of the\n"
+                    "                      operating system (for very large files).\n"
+                    "  --endian <order>    Set the byte order of multi-byte elements: 'little'\n"
+                    "                      (default) or 'big'.\n"
+                    "  -f|--format <name>  Set the output format:\n"
+                    "                      array   a C array with hex values (default)\n"
+                    "                      incbin  an assembler file that includes the input file\n"
+                    "                              with '.incbin', plus a header with declarations\n"
+                    "                      embed   a C array that includes the input file with the\n"
+                    "                              C23 '#embed' directive\n"
+                    "                      string  a C array initialized with string literals\n"
+                    "                              (of up to 65534 bytes, see --split)\n"
                     "  -h|--help           Show brief help.\n"
+                    "  -j|--jobs <number>  Format the array on multiple threads (default = 1);\n"
+                    "                      use 0 for one thread per CPU core. With --blocksize,\n"
+                    "                      the blocks are also compressed in parallel.\n"
+                    "  --level <number>    Set the compression level (the range and the default\n"
+                    "                      depend on the codec).\n"
                     "  -l|--label <name>   Set the symbol name for the array. In the label name,\n"
                     "                      '$*' is replaced with the base filename (no extension)\n"
                     "                      and '$@' is replaced with the full filename. The default\n"
                     "                      label name is '$*'.\n"
                     "  -m|--mutable        Declare the array as mutable (non-const).\n"
-                    "  -t|--text           Open the input file as a text file (Windows only).\n"
+                    "  --namespace <name>  Declare the data in this C++ namespace (implies --cpp).\n"
+                    "  -o|--output <name>  Write all arrays to this file (all other file names on\n"
+                    "                      the command line are input files).\n"
+                    "  --section <name>    Place the array in the linker section with this name.\n"
+                    "  --shards <number>   Write the array in this number of separate .c files,\n"
+                    "                      for compiling in parallel.\n"
+                    "  --sparse            Leave out runs of zeros and write runs of another\n"
+                    "                      value as a range, with designated initializers.\n"
+                    "  --split <size>      Split the array into sub-arrays of at most this size\n"
+                    "                      (suffix 'k', 'M' or 'G'), with a table of pointers.\n"
+                    "  -t|--text           Translate CR-LF pairs in the input file to LF.\n"
+                    "  --stats             Print the time spent in each phase, and the amount of\n"
+                    "                      data read and written, on stderr (--stats-json for\n"
+                    "                      output in JSON).\n"
+                    "  -u|--update         Only write the output file if the input files or the\n"
+                    "                      options changed since the output file was generated.\n"
+                    "  --worker            Stay running, and read conversion requests (as JSON, one\n"
+                    "                      per line) from stdin; -j sets the number of threads.\n"
                     "  -z|--zero           Append a zero terminator at the end of the array.\n\n");
     exit(1);
 }
 
-int
-main(int argc, char *argv[])
+#define OUTPUT_BLOCK    (1024 * 1024)   /* size of the output buffer */
+#define DIRECT_ALIGN    4096            /* alignment for unbuffered writes (option --direct) */
+#define ROW_BYTES       16              /* input bytes per row in the array */
+#define INPUT_BLOCK     (256 * 1024)    /* size of the read buffer (streaming mode) */
+#define JOB_BLOCK       (1024 * 1024)   /* input bytes per thread, for multithreaded formatting */
+#define MAX_JOBS        256
+
+/* flags for the definitions that are emitted once per output file */
+#define EMITTED_CODECS  0x0001
+#define EMITTED_BLOCKS  0x0002
+#define EMITTED_BUNDLE  0x0004
+#define EMITTED_ATTRIBUTES 0x0008
+#define EMITTED_DECOMPRESS 0x0010
+#define EMITTED_ACCESSOR 0x0020
+#define EMITTED_PAGER   0x0040
+#define EMITTED_PATCH   0x0080
+#define EMITTED_CPP     0x0100
+
+/* Statistics for the option --stats: the time spent in each phase, and a few
+   counters. Phases nest (the compressor calls the formatter, which calls the
+   writer), and time is attributed to the innermost phase. Phases are only
+   entered on the main thread; the CPU time of the worker threads is included
+   in the phase that waits for them. In worker mode, each thread that runs
+   requests has statistics of its own. */
+enum {
+    PHASE_OTHER,
+    PHASE_OPEN,
+    PHASE_READ,
+    PHASE_COMPRESS,
+    PHASE_FORMAT,
+    PHASE_WRITE,
+    PHASE_CLOSE,
+    PHASE_COUNT
+};
+static const char *phase_names[PHASE_COUNT] = { "other", "open", "read", "compress", "format", "write", "close" };
+
+typedef struct tagSTATS {
+    int enabled;                /* 0 = off, 1 = text, 2 = JSON */
+    int stack[8];               /* nested phases, stack[0] is PHASE_OTHER */
+    int depth;
+    double wall_mark, cpu_mark; /* clocks at the last phase change */
+    double wall[PHASE_COUNT];
+    double cpu[PHASE_COUNT];
+    uint64_t bytes_in;
+    uint64_t bytes_compressed;  /* compressed size (of compressed files only) */
+    uint64_t bytes_compressible;/* uncompressed size of the compressed files */
+    uint64_t bytes_out;
+    uint64_t write_calls;
+    unsigned int files;
+} STATS;
+
+static THREAD_LOCAL STATS stats;
+
+static double wall_clock(void)
 {
-    const char *f_inputname = NULL;
-    char *f_outputname = NULL;
-    char *symbolname = NULL;
-    bool local_outputname = false;  /* name of output file was generated from input */
+#if defined _WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
 
-    bool is_appending = false;
-    bool is_textfile = false;
-    bool is_mutable = false;
-    bool use_macro = false;
-    bool zero_terminate = false;
-    unsigned int bitsize = 8;
+/* cpu_clock() returns the CPU time of the process (all threads) */
+static double cpu_clock(void)
+{
+#if defined _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    ULARGE_INTEGER k = { { kernel.dwLowDateTime, kernel.dwHighDateTime } };
+    ULARGE_INTEGER u = { { user.dwLowDateTime, user.dwHighDateTime } };
+    return (k.QuadPart + u.QuadPart) / 1e7;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
 
-    /* parse command line */
-    if (argc <= 1)
-        about(NULL);
-    for (int idx = 1; idx < argc; idx++) {
-        if (argv[idx][0] == '-') {
-            if (strcmp(argv[idx], "-a") == 0 || strcmp(argv[idx], "--append") == 0) {
-                is_appending = true;
-            } else if (strncmp(argv[idx], "-b", 2) == 0 || strncmp(argv[idx], "--bits", 6) == 0) {
-                unsigned int j = (argv[idx][1] == '-') ? 6 : 2;
-                if (isdigit(argv[idx][j]))
-                    bitsize = atoi(&argv[idx][j]);
-                else if (argv[idx][j] == '\0' && (idx + 1) < argc)
-                    bitsize = atoi(argv[++idx]);
-                else
-                    about(argv[idx]); /* invalid option */
-                if (bitsize != 8 && bitsize != 16 && bitsize != 32)
-                    fatal("Invalid bit size (must be 8, 16 or 32).");
-            } else if (strcmp(argv[idx], "-d") == 0 || strcmp(argv[idx], "--define") == 0) {
-                use_macro = true;
-            } else if (strcmp(argv[idx], "-h") == 0 || strcmp(argv[idx], "--help") == 0 || strcmp(argv[idx], "-?") == 0) {
-                about(NULL);
-            } else if (strncmp(argv[idx], "-l", 2) == 0 || strncmp(argv[idx], "--label", 7) == 0) {
-                unsigned int j = (argv[idx][1] == '-') ? 7 : 2;
-                if (argv[idx][j] != '\0')
-                    symbolname = &argv[idx][j];
-                else if ((idx + 1) < argc)
-                    symbolname = argv[++idx];
-                else
-                    about(argv[idx]); /* invalid option */
-            } else if (strcmp(argv[idx], "-m") == 0 || strcmp(argv[idx], "--mutable") == 0) {
-                is_mutable = true;
-            } else if (strcmp(argv[idx], "-t") == 0 || strcmp(argv[idx], "--text") == 0) {
-                is_textfile = true;
-            } else if (strcmp(argv[idx], "-z") == 0 || strcmp(argv[idx], "--zero") == 0) {
-                zero_terminate = true;
-            }
-        } else {
-            if (f_inputname == NULL)
-                f_inputname = argv[idx];
-            else if (f_outputname == NULL)
-                f_outputname = argv[idx];
-            else
-                fatal("Too many filenames. Use 'bin2c --help' for usage information.");
-        }
+/* stats_account() adds the time since the last phase change to the current phase */
+static void stats_account(void)
+{
+    double wall = wall_clock();
+    double cpu = cpu_clock();
+    int phase = stats.stack[stats.depth];
+    stats.wall[phase] += wall - stats.wall_mark;
+    stats.cpu[phase] += cpu - stats.cpu_mark;
+    stats.wall_mark = wall;
+    stats.cpu_mark = cpu;
+}
+
+static void stats_enter(int phase)
+{
+    if (!stats.enabled)
+        return;
+    assert(stats.depth + 1 < (int)(sizeof stats.stack / sizeof stats.stack[0]));
+    stats_account();
+    stats.stack[++stats.depth] = phase;
+}
+
+static void stats_leave(void)
+{
+    if (!stats.enabled)
+        return;
+    assert(stats.depth > 0);
+    stats_account();
+    stats.depth--;
+}
+
+static void stats_start(int mode)
+{
+    memset(&stats, 0, sizeof stats);
+    stats.enabled = mode;
+    stats.wall_mark = wall_clock();
+    stats.cpu_mark = cpu_clock();
+}
+
+/* peak_memory() returns the peak resident memory of the process, in KiB */
+static uint64_t peak_memory(void)
+{
+#if defined _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters))
+        return counters.PeakWorkingSetSize / 1024;
+    return 0;
+#elif defined __unix__ || defined __APPLE__
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#   if defined __APPLE__
+    return (uint64_t)usage.ru_maxrss / 1024;    /* macOS reports bytes */
+#   else
+    return (uint64_t)usage.ru_maxrss;
+#   endif
+#else
+    return 0;
+#endif
+}
+
+/* stats_report() prints the statistics on stderr, as a table or as JSON */
+static void stats_report(void)
+{
+    stats_account();
+    double wall = 0, cpu = 0;
+    for (int idx = 0; idx < PHASE_COUNT; idx++) {
+        wall += stats.wall[idx];
+        cpu += stats.cpu[idx];
     }
+    double ratio = (stats.bytes_compressible > 0)
+                   ? (double)stats.bytes_compressed / (double)stats.bytes_compressible : 1.0;
+    if (stats.enabled == 2) {
+        fprintf(stderr, "{\"phases\":{");
+        for (int idx = 0; idx < PHASE_COUNT; idx++)
+            fprintf(stderr, "%s\"%s\":{\"wall\":%.6f,\"cpu\":%.6f}", (idx > 0) ? "," : "",
+                    phase_names[idx], stats.wall[idx], stats.cpu[idx]);
+        fprintf(stderr, "},\"wall\":%.6f,\"cpu\":%.6f,\"files\":%u,\"bytes_in\":%" PRIu64
+                        ",\"bytes_compressed\":%" PRIu64 ",\"compression_ratio\":%.4f"
+                        ",\"bytes_out\":%" PRIu64 ",\"write_calls\":%" PRIu64
+                        ",\"peak_memory_kb\":%" PRIu64 "}\n",
+                wall, cpu, stats.files, stats.bytes_in, stats.bytes_compressed, ratio,
+                stats.bytes_out, stats.write_calls, peak_memory());
+        return;
+    }
+    fprintf(stderr, "Phase          Wall (s)    CPU (s)\n");
+    for (int idx = 0; idx < PHASE_COUNT; idx++)
+        fprintf(stderr, "%-10s %12.6f %10.6f\n", phase_names[idx], stats.wall[idx], stats.cpu[idx]);
+    fprintf(stderr, "%-10s %12.6f %10.6f\n\n", "total", wall, cpu);
+    fprintf(stderr, "Input files:   %u\n", stats.files);
+    fprintf(stderr, "Bytes in:      %" PRIu64 "\n", stats.bytes_in);
+    if (stats.bytes_compressible > 0)
+        fprintf(stderr, "Compressed:    %" PRIu64 " (ratio %.4f)\n", stats.bytes_compressed, ratio);
+    fprintf(stderr, "Bytes out:     %" PRIu64 " (%" PRIu64 " write calls)\n", stats.bytes_out, stats.write_calls);
+    fprintf(stderr, "Peak memory:   %" PRIu64 " KiB\n", peak_memory());
+}
 
-    /* test input, make default names for output and symbol name (if needed) */
-    if (f_inputname == NULL)
-        fatal("No input file. Use 'bin2c --help' for usage information.");
-    if (f_outputname == NULL) {
-        char *ext;
-        f_outputname = malloc(strlen(f_inputname) + 3); /* +2 for ".h" extension, +1 for '\0' */
-        if (f_outputname == NULL)
-            fatal("Memory allocation error.");
-        strcpy(f_outputname, f_inputname);
-        ext = strrchr(f_outputname, '.');
-        if (ext != NULL && strpbrk(f_outputname, "\\/") == NULL)
-            *ext = '\0';    /* remove old extension */
-        strcat(f_outputname, ".h");
-        local_outputname = true;
+/* The output is collected in a large buffer, which is written in one call
+   each time that it fills up (the stdio stream is unbuffered, to avoid copying
+   the data once more). A new output file is written under a temporary name,
+   and renamed to the real name when it is complete, so that the file is
+   replaced at once. With the option --direct, the file is written without the
+   cache of the operating system; the writes are then whole multiples of
+   DIRECT_ALIGN (from an aligned buffer), except for the last one. */
+typedef struct tagOUTPUT {
+    FILE *fp;
+    char *buffer;               /* aligned on DIRECT_ALIGN */
+    char *memory;               /* allocated block that holds the buffer */
+    size_t pos;
+    unsigned int emitted;       /* EMITTED_xxx flags */
+    char *name;                 /* real name of the file, if written as "tempname" */
+    char *tempname;
+    bool direct;                /* whether the file is written unbuffered */
+    uint64_t offset;            /* number of bytes written to the file */
+#if defined _WIN32
+    HANDLE hfile;               /* file handle for unbuffered writes */
+#else
+    int fd;                     /* file descriptor for unbuffered writes */
+#endif
+} OUTPUT;
+
+static THREAD_LOCAL bool direct_output = false;  /* option --direct */
+
+/* with --update, the hash of the output file that is being written; it is
+   stored in the banner of that file, and of the files that go with it */
+static THREAD_LOCAL bool has_banner_hash = false;
+static THREAD_LOCAL uint64_t banner_hash;
+
+/* temporary output files that are not yet renamed, for removal when Bin2C
+   exits on an error (or when a request fails, in worker mode) */
+static THREAD_LOCAL char *temp_files[4];
+
+static void remove_temp_files(void)
+{
+    for (int idx = 0; idx < (int)(sizeof temp_files / sizeof temp_files[0]); idx++) {
+        if (temp_files[idx] != NULL)
+            remove(temp_files[idx]);
+        temp_files[idx] = NULL;
     }
-    /* prepare names for the automatic label */
-    const char *fpos = f_inputname;
-    while (strpbrk(fpos, "\\/") != NULL)
-        fpos = strpbrk(fpos, "\\/") + 1;    /* skip all directory names */
-    char *fullname = malloc(strlen(fpos) + 1);  /* +1 for '\0' */
-    if (fullname == NULL)
-        fatal("Memory allocation error.");
-    strcpy(fullname, fpos);
-    char *basename = strdup(fullname);
-    if (basename == NULL)
+}
+
+static void track_temp_file(char *name, bool add)
+{
+    int idx = 0;
+    while (idx < (int)(sizeof temp_files / sizeof temp_files[0]) && temp_files[idx] != (add ? NULL : name))
+        idx++;
+    assert(idx < (int)(sizeof temp_files / sizeof temp_files[0]));
+    temp_files[idx] = add ? name : NULL;
+}
+
+/* outputs that are initialized but not yet closed, for closing them when a
+   request fails in worker mode */
+static THREAD_LOCAL OUTPUT *open_outputs[4];
+
+static void track_output(OUTPUT *out, bool add)
+{
+    int idx = 0;
+    while (idx < (int)(sizeof open_outputs / sizeof open_outputs[0]) && open_outputs[idx] != (add ? NULL : out))
+        idx++;
+    assert(idx < (int)(sizeof open_outputs / sizeof open_outputs[0]));
+    open_outputs[idx] = add ? out : NULL;
+}
+
+/* In worker mode, a thread keeps its output buffer between requests; the
+   buffer stays with the thread when a request fails */
+static THREAD_LOCAL char *warm_output;
+static THREAD_LOCAL bool warm_output_busy;
+
+static void output_init(OUTPUT *out, FILE *fp)
+{
+    memset(out, 0, sizeof(OUTPUT));
+    out->fp = fp;
+    if (in_request() && !warm_output_busy) {
+        if (warm_output == NULL)
+            warm_output = malloc(OUTPUT_BLOCK + DIRECT_ALIGN);
+        out->memory = warm_output;
+        warm_output_busy = true;
+    } else {
+        out->memory = malloc(OUTPUT_BLOCK + DIRECT_ALIGN);
+    }
+    if (out->memory == NULL)
         fatal("Memory allocation error.");
-    char *ext = strrchr(basename, '.');
-    if (ext != NULL)
-        *ext = '\0';    /* remove extension from base name */
-    fpos = symbolname;
-    if (fpos == NULL)
-        fpos = "$*";
-    size_t symlen = strlen(fpos);
-    if (strstr(fpos, "$*") != NULL)
-        symlen += strlen(basename);
-    if (strstr(fpos, "$@") != NULL)
-        symlen += strlen(fullname);
-    symbolname = malloc(symlen + 1);  /* +1 for '\0' */
-    if (symbolname == NULL)
+    out->buffer = out->memory + (DIRECT_ALIGN - (uintptr_t)out->memory % DIRECT_ALIGN) % DIRECT_ALIGN;
+    track_output(out, true);
+}
+
+/* output_raw() writes a block to the file */
+static void output_raw(OUTPUT *out, const char *data, size_t size)
+{
+    stats_enter(PHASE_WRITE);
+    bool ok = true;
+    if (out->direct) {
+#if defined _WIN32
+        DWORD count;
+        ok = WriteFile(out->hfile, data, (DWORD)size, &count, NULL) && count == size;
+#else
+        for (size_t done = 0; ok && done < size; ) {
+            ssize_t count = write(out->fd, data + done, size - done);
+            ok = (count > 0);
+            if (ok)
+                done += (size_t)count;
+        }
+#endif
+    } else if (size > 0) {
+        ok = (fwrite(data, 1, size, out->fp) == size);
+    }
+    if (!ok)
+        fatal("Failed to write to the output file.");
+    out->offset += size;
+    stats.bytes_out += size;
+    stats.write_calls++;
+    stats_leave();
+}
+
+/* output_flush() writes the buffer; for unbuffered writes, only the whole
+   multiples of DIRECT_ALIGN are written, and the rest stays in the buffer */
+static void output_flush(OUTPUT *out)
+{
+    size_t count = out->direct ? out->pos & ~(size_t)(DIRECT_ALIGN - 1) : out->pos;
+    if (count == 0)
+        return;
+    output_raw(out, out->buffer, count);
+    memmove(out->buffer, out->buffer + count, out->pos - count);
+    out->pos -= count;
+}
+
+/* temp_serial() returns a new number for a temporary file on each call, so
+   that threads in worker mode that write the same file use different names */
+static unsigned long temp_serial(void)
+{
+#if defined _WIN32
+    static volatile LONG serial = 0;
+    return (unsigned long)InterlockedIncrement(&serial);
+#elif defined __GNUC__ || defined __clang__
+    static unsigned long serial = 0;
+    return __atomic_add_fetch(&serial, 1, __ATOMIC_RELAXED);
+#else
+    static unsigned long serial = 0;
+    return ++serial;
+#endif
+}
+
+/* output_open() opens the output file (or standard output, for "-"); a file
+   that is not appended to is created under a temporary name */
+static void output_open(OUTPUT *out, const char *name, bool append)
+{
+    stats_enter(PHASE_OPEN);
+    out->pos = 0;
+    out->emitted = 0;
+    out->direct = false;
+    out->offset = 0;
+    out->name = out->tempname = NULL;
+    if (strcmp(name, "-") == 0) {
+#if defined _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        out->fp = stdout;
+        stats_leave();
+        return;
+    }
+    if (append) {
+        out->fp = fopen(name, "ab");
+        if (out->fp == NULL)
+            fatal("Failed to open %s for writing", name);
+        setvbuf(out->fp, NULL, _IONBF, 0);
+        stats_leave();
+        return;
+    }
+    out->name = strdup(name);
+    out->tempname = malloc(strlen(name) + 64);
+    if (out->name == NULL || out->tempname == NULL)
         fatal("Memory allocation error.");
-    *symbolname = '\0';
-    while (*fpos != '\0') {
-        if (strncmp(fpos, "$*", 2) == 0) {
-            strcat(symbolname, basename);
-            fpos += 2;
-        } else if (strncmp(fpos, "$@", 2) == 0) {
-            strcat(symbolname, fullname);
-            fpos += 2;
-        } else {
-            size_t len = strlen(symbolname);
-            symbolname[len] = *fpos;
-            symbolname[len+1] = '\0';
-            fpos += 1;
+#if defined _WIN32
+    sprintf(out->tempname, "%s.%lu.%lu.tmp", name, (unsigned long)GetCurrentProcessId(), temp_serial());
+#else
+    sprintf(out->tempname, "%s.%lu.%lu.tmp", name, (unsigned long)getpid(), temp_serial());
+#endif
+    track_temp_file(out->tempname, true);
+    if (direct_output) {
+        /* if the file system does not support unbuffered writes, the file is
+           written normally */
+#if defined _WIN32
+        out->hfile = CreateFileA(out->tempname, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, NULL);
+        out->direct = (out->hfile != INVALID_HANDLE_VALUE);
+#elif defined O_DIRECT
+        out->fd = open(out->tempname, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+        out->direct = (out->fd >= 0);
+#endif
+    }
+    if (!out->direct) {
+        out->fp = fopen(out->tempname, "wb");
+        if (out->fp == NULL)
+            fatal("Failed to open %s for writing", name);
+        setvbuf(out->fp, NULL, _IONBF, 0);
+    }
+    stats_leave();
+}
+
+/* output_done() writes the rest of the buffer and closes the output file (but
+   standard output is only flushed); a temporary file is then renamed to the
+   real name, replacing any existing file */
+static void output_done(OUTPUT *out)
+{
+    bool ok = true;
+    if (out->direct) {
+        /* the last block is not a multiple of the alignment */
+#if defined _WIN32
+        LARGE_INTEGER size;
+        size.QuadPart = out->offset + out->pos;
+        size_t padded = (out->pos + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+        memset(out->buffer + out->pos, 0, padded - out->pos);
+        output_raw(out, out->buffer, padded);
+        stats_enter(PHASE_CLOSE);
+        ok = SetFilePointerEx(out->hfile, size, NULL, FILE_BEGIN) && SetEndOfFile(out->hfile);
+        ok = CloseHandle(out->hfile) && ok;
+#else
+        ok = (fcntl(out->fd, F_SETFL, fcntl(out->fd, F_GETFL) & ~O_DIRECT) == 0);
+        output_raw(out, out->buffer, out->pos);
+        stats_enter(PHASE_CLOSE);
+        ok = (close(out->fd) == 0) && ok;
+#endif
+        out->pos = 0;
+        out->direct = false;
+    } else {
+        output_flush(out);
+        stats_enter(PHASE_CLOSE);
+        ok = (out->fp == stdout) ? (fflush(stdout) == 0) : (fclose(out->fp) == 0);
+    }
+    out->fp = NULL;
+    if (!ok)
+        fatal("Failed to write to the output file.");
+    if (out->tempname != NULL) {
+#if defined _WIN32
+        ok = MoveFileExA(out->tempname, out->name, MOVEFILE_REPLACE_EXISTING);
+#else
+        ok = (rename(out->tempname, out->name) == 0);
+#endif
+        if (!ok)
+            fatal("Failed to rename %s to %s.", out->tempname, out->name);
+        track_temp_file(out->tempname, false);
+        free(out->tempname);
+        free(out->name);
+        out->name = out->tempname = NULL;
+    }
+    stats_leave();
+}
+
+static void output_close(OUTPUT *out)
+{
+    if (out->memory != NULL && out->memory == warm_output)
+        warm_output_busy = false;
+    else
+        free(out->memory);
+    out->memory = out->buffer = NULL;
+    track_output(out, false);
+}
+
+/* output_abandon() closes an output file without writing the rest of the
+   buffer, removes its temporary file, and then releases the output */
+static void output_abandon(OUTPUT *out)
+{
+    if (out->direct) {
+#if defined _WIN32
+        CloseHandle(out->hfile);
+#else
+        close(out->fd);
+#endif
+    } else if (out->fp != NULL && out->fp != stdout) {
+        fclose(out->fp);
+    }
+    out->fp = NULL;
+    out->direct = false;
+    if (out->tempname != NULL) {
+        remove(out->tempname);
+        track_temp_file(out->tempname, false);
+        free(out->tempname);
+        free(out->name);
+        out->name = out->tempname = NULL;
+    }
+    output_close(out);
+}
+
+/* output_write() copies small blocks into the buffer, but writes large blocks
+   directly (after flushing the buffer); unbuffered writes always go through
+   the buffer, for the alignment */
+static void output_write(OUTPUT *out, const char *text, size_t size)
+{
+    if (out->pos + size <= OUTPUT_BLOCK) {
+        memcpy(out->buffer + out->pos, text, size);
+        out->pos += size;
+    } else if (out->direct) {
+        while (size > 0) {
+            if (out->pos == OUTPUT_BLOCK)
+                output_flush(out);
+            size_t count = (size < OUTPUT_BLOCK - out->pos) ? size : OUTPUT_BLOCK - out->pos;
+            memcpy(out->buffer + out->pos, text, count);
+            out->pos += count;
+            text += count;
+            size -= count;
         }
+    } else {
+        output_flush(out);
+        output_raw(out, text, size);
     }
-    free(fullname);
-    free(basename);
-    char *ptr = symbolname;
-    if (!isalpha(*ptr) && *ptr != '_')
-        *ptr = '_';
-    while (*ptr != '\0') {
-        if (!isalnum(*ptr) && *ptr != '_')
-            *ptr = '_';
-        ptr++;
+}
+
+/* output_reserve() makes sure that at least "size" bytes are available in the
+   buffer, and returns a pointer to the first free byte; the caller then advances
+   "pos" by the number of bytes that it actually stored */
+static char *output_reserve(OUTPUT *out, size_t size)
+{
+    assert(size <= OUTPUT_BLOCK);
+    if (out->pos + size > OUTPUT_BLOCK)
+        output_flush(out);
+    return out->buffer + out->pos;
+}
+
+static void output_printf(OUTPUT *out, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(out->buffer + out->pos, OUTPUT_BLOCK - out->pos, fmt, ap);
+    va_end(ap);
+    assert(len >= 0 && len < OUTPUT_BLOCK);
+    if (out->pos + len >= OUTPUT_BLOCK) {
+        /* did not fit, flush the buffer and try again */
+        output_flush(out);
+        va_start(ap, fmt);
+        len = vsnprintf(out->buffer + out->pos, OUTPUT_BLOCK - out->pos, fmt, ap);
+        va_end(ap);
     }
+    out->pos += len;
+}
+
+/* output_banner() writes the "generated by Bin2C" comment on the first line of
+   a file, with the hash for --update (if set) */
+static void output_banner(OUTPUT *out)
+{
+    if (has_banner_hash)
+        output_printf(out, "/* generated by Bin2C, hash %016" PRIx64 " */\n", banner_hash);
+    else
+        output_printf(out, "/* generated by Bin2C */\n");
+}
 
-    FILE *f_input = fopen(f_inputname, is_textfile ? "rt" : "rb");
-    if (f_input == NULL)
-        fatal("Failed to open %s for reading.", f_inputname);
+/* The input is either mapped in memory (for regular files), or read in blocks
+   through the C library (for pipes, and for systems without memory mapping). In both cases, input_read() returns a
+   pointer to the next portion of the data. */
+typedef struct tagINPUT {
+    FILE *fp;
+    const uint8_t *view;        /* mapped view of the file, or NULL */
+    size_t view_size;
+    size_t view_pos;
+    uint8_t *buffer;            /* read buffer, when the file is not mapped */
+    size_t blocksize;           /* maximum size returned by input_read() */
+    bool spooled;               /* standard input, read completely in "buffer" */
+#if defined _WIN32
+    HANDLE hmap;
+#endif
+} INPUT;
 
-    /* get the length of the input file, then read it fully in memory */
-    fseek(f_input, 0, SEEK_END);
-    unsigned int file_size = ftell(f_input);
-    fseek(f_input, 0, SEEK_SET);
-    if (zero_terminate)
-        file_size += 1;
-    uint8_t *buf = (uint8_t *)calloc(file_size, 1);
-    if (buf == NULL)
-        fatal("Memory allocation error.");
-    fread(buf, file_size, 1, f_input);
-    fclose(f_input);
+/* inputs that are initialized but not yet closed, for closing them when a
+   request fails in worker mode */
+static THREAD_LOCAL INPUT *open_inputs[4];
 
-#ifdef USE_BZ2
-    // allocate for bz2.
-    unsigned int bz2_size =
-      (file_size + file_size / 100 + 1) + 600; // as per the documentation
+static void track_input(INPUT *in, bool add)
+{
+    int idx = 0;
+    while (idx < (int)(sizeof open_inputs / sizeof open_inputs[0]) && open_inputs[idx] != (add ? NULL : in))
+        idx++;
+    assert(idx < (int)(sizeof open_inputs / sizeof open_inputs[0]));
+    open_inputs[idx] = add ? in : NULL;
+}
 
-    uint8_t *bz2_buf = (uint8_t *) malloc(bz2_size);
-    assert(bz2_buf);
+static void input_init(INPUT *in, FILE *fp, bool allow_map, size_t blocksize)
+{
+    in->fp = fp;
+    in->blocksize = blocksize;
+    in->view = NULL;
+    in->view_size = in->view_pos = 0;
+    in->buffer = NULL;
+    in->spooled = false;
+#if defined _WIN32
+    in->hmap = NULL;
+    if (allow_map) {
+        HANDLE hfile = (HANDLE)_get_osfhandle(_fileno(fp));
+        LARGE_INTEGER size;
+        if (hfile != INVALID_HANDLE_VALUE && GetFileType(hfile) == FILE_TYPE_DISK
+            && GetFileSizeEx(hfile, &size) && size.QuadPart > 0 && (uint64_t)size.QuadPart <= SIZE_MAX)
+        {
+            in->hmap = CreateFileMapping(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (in->hmap != NULL) {
+                in->view = MapViewOfFile(in->hmap, FILE_MAP_READ, 0, 0, 0);
+                if (in->view != NULL) {
+                    in->view_size = (size_t)size.QuadPart;
+                } else {
+                    CloseHandle(in->hmap);
+                    in->hmap = NULL;
+                }
+            }
+        }
+    }
+#elif defined HAVE_MMAP
+    struct stat st;
+    if (allow_map && fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)
+        && st.st_size > 0 && (uint64_t)st.st_size <= SIZE_MAX)
+    {
+        void *view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+        if (view != MAP_FAILED) {
+            madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+            in->view = view;
+            in->view_size = (size_t)st.st_size;
+        }
+    }
+#else
+    (void)allow_map;
+#endif
+    track_input(in, true);
+    if (in->view == NULL) {
+        in->buffer = malloc(blocksize);
+        if (in->buffer == NULL)
+            fatal("Memory allocation error.");
+    }
+}
+
+/* input_gather() reads the remaining data of a file that is not mapped in
+   memory into the buffer, so that the complete data is available as a view
+   (a mapped file is left as is); it returns false on a read error */
+static bool input_gather(INPUT *in)
+{
+    if (in->view != NULL)
+        return true;
+    size_t capacity = in->blocksize, size = 0;
+    for ( ;; ) {
+        if (size == capacity) {
+            capacity *= 2;
+            uint8_t *buffer = realloc(in->buffer, capacity);
+            if (buffer == NULL)
+                fatal("Memory allocation error.");
+            in->buffer = buffer;
+        }
+        size_t count = fread(in->buffer + size, 1, capacity - size, in->fp);
+        if (count == 0)
+            break;
+        size += count;
+    }
+    in->view = in->buffer;
+    in->view_size = size;
+    in->spooled = true;
+    return !ferror(in->fp);
+}
+
+/* input_spool() reads all data from a pipe (standard input) into memory,
+   because its size must be known before the array is declared; the buffer is
+   then used as if it were a mapped view */
+static void input_spool(INPUT *in, FILE *fp, size_t blocksize)
+{
+    input_init(in, fp, false, blocksize);
+    if (!input_gather(in))
+        fatal("Failed to read from standard input.");
+}
 
-    // compress the data
-    int status =
-      BZ2_bzBuffToBuffCompress(bz2_buf, &bz2_size, buf, file_size, 9, 1, 0);
+/* input_memory() sets up an input that reads from a buffer (allocated with
+   malloc(), the input takes ownership of it) */
+static void input_memory(INPUT *in, uint8_t *buffer, size_t size, size_t blocksize)
+{
+    memset(in, 0, sizeof(INPUT));
+    in->blocksize = blocksize;
+    in->buffer = buffer;
+    in->view = buffer;
+    in->view_size = size;
+    in->spooled = true;
+    track_input(in, true);
+}
 
-    if (status != BZ_OK)
-        fatal("Failed to compress data: error %i.", status);
+/* input_read() reads up to "size" bytes (but at most the block size that was
+   set on initialization) and sets "data" to point to these; it returns the
+   number of bytes, 0 at end of file */
+static size_t input_read(INPUT *in, const uint8_t **data, size_t size)
+{
+    if (size > in->blocksize)
+        size = in->blocksize;
+    if (in->view != NULL) {
+        if (size > in->view_size - in->view_pos)
+            size = in->view_size - in->view_pos;
+        *data = in->view + in->view_pos;
+        in->view_pos += size;
+    } else {
+        stats_enter(PHASE_READ);
+        *data = in->buffer;
+        size = fread(in->buffer, 1, size, in->fp);
+        stats_leave();
+    }
+    stats.bytes_in += size;
+    return size;
+}
 
-    // and be very lazy
-    free(buf);
-    unsigned int uncompressed_size = file_size;
-    file_size = bz2_size;
-    buf = bz2_buf;
+/* input_unmap() releases the mapped view of the file (if any) */
+static void input_unmap(INPUT *in)
+{
+#if defined _WIN32
+    if (in->view != NULL && !in->spooled) {
+        UnmapViewOfFile(in->view);
+        CloseHandle(in->hmap);
+    }
+#elif defined HAVE_MMAP
+    if (in->view != NULL && !in->spooled)
+        munmap((void *)in->view, in->view_size);
 #endif
+}
 
-    FILE *f_output;
-    if(is_appending)
-        f_output = fopen(f_outputname, "a+t");
-    else
-        f_output = fopen(f_outputname, "wt");
-    if (f_output == NULL)
-        fatal("Failed to open %s for writing", f_outputname);
-
-    if (!is_appending)
-        fprintf(f_output, "/* generated by Bin2C */\n"
-                          "#include <stdint.h>");
-    fprintf(f_output, "\n\n");
-    assert(bitsize == 8 || bitsize == 16 || bitsize == 32);
-    unsigned int array_size = (file_size + ((bitsize >> 3) - 1)) / (bitsize >> 3);
-    if (!is_mutable)
-        fprintf(f_output, "const ");
-    fprintf(f_output, "uint%u_t %s[%u] = {", bitsize, symbolname, array_size);
-    bool need_comma = false;
-    bool need_newline = true;
-    uint32_t word = 0;
-    int bits = 0;
-    for (unsigned int idx = 0; idx < file_size; ++idx) {
-        word |= (uint32_t)buf[idx] << bits;
-        bits += 8;
-        assert(bits <= bitsize);
-        if (bits == bitsize) {
-            if (need_comma)
-                fprintf(f_output, ", ");
-            if (need_newline)
-                fprintf(f_output, "\n\t");
-            if (bitsize == 8)
-                fprintf(f_output, "0x%02x", word);
-            else if (bitsize == 16)
-                fprintf(f_output, "0x%04x", word);
-            else if (bitsize == 32)
-                fprintf(f_output, "0x%08x", word);
-            word = bits = 0;
-            need_comma = true;  /* after first value, comma must always precede any next value */
-            need_newline = (((idx + 1) & 0x0f) == 0);   /* 16 bytes per row */
-        }
-    }
-    if (bits > 0) {
-        if (need_comma)
-            fprintf(f_output, ", ");
-        if (need_newline)
-            fprintf(f_output, "\n\t");
-        if (bitsize == 8)
-            fprintf(f_output, "0x%02x", word);
-        else if (bitsize == 16)
-            fprintf(f_output, "0x%04x", word);
-        else if (bitsize == 32)
-            fprintf(f_output, "0x%08x", word);
-    }
-    fprintf(f_output, "\n};\n\n");
-    if (use_macro)
-        fprintf(f_output, "#define %s_size %u\n", symbolname, array_size);
-    else
-        fprintf(f_output, "const unsigned int %s_size = %u;\n", symbolname, array_size);
+/* strip_crlf() translates CR-LF pairs to LF, from "src" to "dst" (which may be
+   the same buffer); a CR that is not followed by LF is kept. It returns the
+   size of the translated data. The scan for CR characters is done by memchr(),
+   which the C library implements with vector instructions. */
+static size_t strip_crlf(uint8_t *dst, const uint8_t *src, size_t size)
+{
+    const uint8_t *end = src + size;
+    uint8_t *ptr = dst;
+    while (src < end) {
+        const uint8_t *cr = memchr(src, '\r', (size_t)(end - src));
+        size_t run = (size_t)(((cr != NULL) ? cr : end) - src);
+        if (cr != NULL && (cr + 1 == end || cr[1] != '\n'))
+            run += 1;
+        if (ptr != src)
+            memmove(ptr, src, run);
+        ptr += run;
+        src += run;
+        if (src == cr)
+            src += 1;   /* skip the CR of a CR-LF pair */
+    }
+    return (size_t)(ptr - dst);
+}
 
-#ifdef USE_BZ2
-    if (use_macro)
-        fprintf(f_output, "#define %s_size_uncompressed %u\n", symbolname, uncompressed_size);
-    else
-        fprintf(f_output, "const unsigned int %s_size_uncompressed = %u;\n", symbolname, uncompressed_size);
+/* input_text() translates CR-LF pairs to LF in the complete data of the input
+   (see input_gather()); a mapped view is replaced by a buffer in memory */
+static void input_text(INPUT *in)
+{
+    assert(in->view != NULL && in->view_pos == 0);
+    if (in->spooled) {
+        in->view_size = strip_crlf(in->buffer, in->view, in->view_size);
+        return;
+    }
+    uint8_t *buffer = malloc(in->view_size);
+    if (buffer == NULL)
+        fatal("Memory allocation error.");
+    size_t size = strip_crlf(buffer, in->view, in->view_size);
+    input_unmap(in);
+    free(in->buffer);
+    in->buffer = buffer;
+    in->view = buffer;
+    in->view_size = size;
+    in->spooled = true;
+}
+
+static void input_close(INPUT *in)
+{
+    stats_enter(PHASE_CLOSE);
+    input_unmap(in);
+    free(in->buffer);
+    if (in->fp != NULL && in->fp != stdin)
+        fclose(in->fp);
+    in->fp = NULL;
+    track_input(in, false);
+    stats_leave();
+}
+
+static void release_files(void)
+{
+    for (int idx = 0; idx < (int)(sizeof open_inputs / sizeof open_inputs[0]); idx++)
+        if (open_inputs[idx] != NULL)
+            input_close(open_inputs[idx]);
+    for (int idx = 0; idx < (int)(sizeof open_outputs / sizeof open_outputs[0]); idx++)
+        if (open_outputs[idx] != NULL)
+            output_abandon(open_outputs[idx]);
+}
+
+/* Lookup tables for the array elements: hexdigits[] holds the two hex digits
+   of each byte value, hexbyte[] holds the complete ", 0xNN" sequence for 8-bit
+   elements (padded to 8 bytes, so that each entry can be copied as a whole). */
+static char hexdigits[256][2];
+static char hexbyte[256][8];
+
+/* A complete row of 8-bit elements (except the first row of the array) is
+   ", \n\t0xNN, 0xNN, ... 0xNN", which is ROW_TEXT characters; the two hex
+   digits of element k are at positions 6k+6 and 6k+7. The vector kernels build
+   the row in 16-byte pieces, from a template for the fixed characters plus
+   the hex digits shuffled into place. */
+#define ROW_TEXT        (4 + ROW_BYTES * 6 - 2)
+#define ROW_PIECES      ((ROW_TEXT + 15) / 16)
+#if defined HAVE_SSSE3 || defined HAVE_NEON
+static uint8_t row_template[ROW_PIECES][16];
+static uint8_t row_shuffle[2][ROW_PIECES][16];  /* for digits of elements 0-7 and 8-15 */
 #endif
 
-    fclose(f_output);
-    free(buf);
-    if (local_outputname)
-        free(f_outputname);
-    free(symbolname);
+/* format_rows_scalar() is the reference implementation of the row kernels; it
+   formats "rows" complete rows, and may write up to 16 bytes past the end */
+static char *format_rows_scalar(char *ptr, const uint8_t *buf, size_t rows)
+{
+    while (rows-- > 0) {
+        memcpy(ptr, ", \n\t0x", 6);
+        memcpy(ptr + 6, hexdigits[buf[0]], 2);
+        ptr += 8;
+        for (int idx = 1; idx < ROW_BYTES; idx++) {
+            memcpy(ptr, hexbyte[buf[idx]], 8);
+            ptr += 6;
+        }
+        buf += ROW_BYTES;
+    }
+    return ptr;
+}
 
-    return 0;
+#if defined HAVE_SSSE3
+TARGET_SSSE3
+static char *format_rows_ssse3(char *ptr, const uint8_t *buf, size_t rows)
+{
+    const __m128i hexchars = _mm_loadu_si128((const __m128i *)"0123456789abcdef");
+    const __m128i lowmask = _mm_set1_epi8(0x0f);
+    while (rows-- > 0) {
+        __m128i data = _mm_loadu_si128((const __m128i *)buf);
+        __m128i high = _mm_shuffle_epi8(hexchars, _mm_and_si128(_mm_srli_epi16(data, 4), lowmask));
+        __m128i low = _mm_shuffle_epi8(hexchars, _mm_and_si128(data, lowmask));
+        __m128i digits0 = _mm_unpacklo_epi8(high, low);
+        __m128i digits1 = _mm_unpackhi_epi8(high, low);
+        for (int piece = 0; piece < ROW_PIECES; piece++) {
+            __m128i text = _mm_loadu_si128((const __m128i *)row_template[piece]);
+            text = _mm_or_si128(text, _mm_shuffle_epi8(digits0, _mm_loadu_si128((const __m128i *)row_shuffle[0][piece])));
+            text = _mm_or_si128(text, _mm_shuffle_epi8(digits1, _mm_loadu_si128((const __m128i *)row_shuffle[1][piece])));
+            _mm_storeu_si128((__m128i *)(ptr + 16 * piece), text);
+        }
+        ptr += ROW_TEXT;
+        buf += ROW_BYTES;
+    }
+    return ptr;
+}
+
+static bool cpu_has_ssse3(void)
+{
+#   if defined _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#   else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+#   endif
+}
+#endif
+
+#if defined HAVE_NEON
+static char *format_rows_neon(char *ptr, const uint8_t *buf, size_t rows)
+{
+    const uint8x16_t hexchars = vld1q_u8((const uint8_t *)"0123456789abcdef");
+    const uint8x16_t lowmask = vdupq_n_u8(0x0f);
+    while (rows-- > 0) {
+        uint8x16_t data = vld1q_u8(buf);
+        uint8x16_t high = vqtbl1q_u8(hexchars, vshrq_n_u8(data, 4));
+        uint8x16_t low = vqtbl1q_u8(hexchars, vandq_u8(data, lowmask));
+        uint8x16_t digits0 = vzip1q_u8(high, low);
+        uint8x16_t digits1 = vzip2q_u8(high, low);
+        for (int piece = 0; piece < ROW_PIECES; piece++) {
+            uint8x16_t text = vld1q_u8(row_template[piece]);
+            text = vorrq_u8(text, vqtbl1q_u8(digits0, vld1q_u8(row_shuffle[0][piece])));
+            text = vorrq_u8(text, vqtbl1q_u8(digits1, vld1q_u8(row_shuffle[1][piece])));
+            vst1q_u8((uint8_t *)ptr + 16 * piece, text);
+        }
+        ptr += ROW_TEXT;
+        buf += ROW_BYTES;
+    }
+    return ptr;
+}
+#endif
+
+/* the kernel for complete rows is selected at run time, in init_hextables() */
+static char *(*format_rows)(char *ptr, const uint8_t *buf, size_t rows) = format_rows_scalar;
+
+static void init_hextables(void)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (int idx = 0; idx < 256; idx++) {
+        hexdigits[idx][0] = digits[idx >> 4];
+        hexdigits[idx][1] = digits[idx & 0x0f];
+        memcpy(hexbyte[idx], ", 0x", 4);
+        memcpy(hexbyte[idx] + 4, hexdigits[idx], 2);
+        hexbyte[idx][6] = hexbyte[idx][7] = '\0';
+    }
+
+#if defined HAVE_SSSE3 || defined HAVE_NEON
+    /* the fixed characters of a row have zeros at the positions of the digits,
+       the shuffle masks have 0x80 for positions that are not digits (this
+       zeroes the byte with SSSE3 and NEON alike) */
+    char line[ROW_PIECES * 16 + 8];
+    memset(line, 0, sizeof line);
+    memcpy(line, ", \n\t0x", 6);
+    for (int idx = 1; idx < ROW_BYTES; idx++)
+        memcpy(line + 2 + 6 * idx, ", 0x", 4);
+    for (int pos = 0; pos < ROW_PIECES * 16; pos++) {
+        int piece = pos / 16;
+        row_template[piece][pos % 16] = (pos < ROW_TEXT) ? (uint8_t)line[pos] : 0;
+        row_shuffle[0][piece][pos % 16] = row_shuffle[1][piece][pos % 16] = 0x80;
+        if (pos >= 6 && pos < ROW_TEXT && (pos - 6) % 6 < 2) {
+            int digit = 2 * ((pos - 6) / 6) + (pos - 6) % 6;   /* index in the interleaved digits */
+            row_shuffle[digit / 16][piece][pos % 16] = (uint8_t)(digit % 16);
+        }
+    }
+#endif
+#if defined HAVE_SSSE3
+    if (cpu_has_ssse3())
+        format_rows = format_rows_ssse3;
+#elif defined HAVE_NEON
+    format_rows = format_rows_neon;
+#endif
+}
+
+/* The worst case of the number of output characters per input byte is for
+   8-bit elements, where each byte takes 6 characters (", 0xNN"), plus two
+   characters for the line break per row; plus slack for the 8-byte and 16-byte
+   stores. */
+#define FORMAT_SIZE(bytes)  ((bytes) * 6 + ((bytes) / ROW_BYTES + 1) * 2 + 16)
+
+/* format_word() formats a single element of "wordsize" bytes as a hex value */
+static char *format_word(char *ptr, const uint8_t *word, unsigned int wordsize, bool big_endian)
+{
+    *ptr++ = '0';
+    *ptr++ = 'x';
+    if (big_endian) {
+        for (unsigned int b = 0; b < wordsize; b++) {
+            memcpy(ptr, hexdigits[word[b]], 2);
+            ptr += 2;
+        }
+    } else {
+        for (int b = wordsize - 1; b >= 0; b--) {
+            memcpy(ptr, hexdigits[word[b]], 2);
+            ptr += 2;
+        }
+    }
+    return ptr;
+}
+
+/* format_words() formats "size" bytes from "buf" as array elements of "bitsize"
+   bits each, in Big Endian or Little Endian byte order, where "offset" is the position of the first byte in the input
+   file (a comma precedes every element but the first, and a new row starts at
+   every multiple of ROW_BYTES); "size" must be a multiple of the element size.
+   The text is stored in "ptr", which must be at least FORMAT_SIZE(size) bytes;
+   the function returns the pointer behind the formatted text. */
+static char *format_words(char *ptr, const uint8_t *buf, size_t size,
+                          unsigned int bitsize, bool big_endian, uint64_t offset)
+{
+    unsigned int wordsize = bitsize >> 3;
+    assert(size % wordsize == 0);
+    if (bitsize == 8) {
+        /* optimized path for the most common case */
+        size_t idx = 0;
+        while (idx < size) {
+            if ((offset & (ROW_BYTES - 1)) == 0 && offset > 0 && size - idx >= ROW_BYTES) {
+                size_t rows = (size - idx) / ROW_BYTES;
+                ptr = format_rows(ptr, buf + idx, rows);
+                idx += rows * ROW_BYTES;
+                offset += rows * ROW_BYTES;
+                continue;
+            }
+            if ((offset & (ROW_BYTES - 1)) == 0) {
+                if (offset > 0) {
+                    *ptr++ = ',';
+                    *ptr++ = ' ';
+                }
+                memcpy(ptr, "\n\t0x", 4);
+                memcpy(ptr + 4, hexdigits[buf[idx]], 2);
+                ptr += 6;
+                idx++;
+                offset++;
+            }
+            while (idx < size && (offset & (ROW_BYTES - 1)) != 0) {
+                memcpy(ptr, hexbyte[buf[idx]], 8);
+                ptr += 6;
+                idx++;
+                offset++;
+            }
+        }
+        return ptr;
+    }
+    for (size_t idx = 0; idx < size; idx += wordsize, offset += wordsize) {
+        if (offset > 0) {
+            *ptr++ = ',';
+            *ptr++ = ' ';
+        }
+        if ((offset & (ROW_BYTES - 1)) == 0) {
+            *ptr++ = '\n';
+            *ptr++ = '\t';
+        }
+        ptr = format_word(ptr, buf + idx, wordsize, big_endian);
+    }
+    return ptr;
+}
+
+/* A 64-bit hash (the XXH64 algorithm, with seed 0) over input files and
+   options, for checking whether an output file is up-to-date. The data may be
+   added in portions of any size. */
+#define HASH_P1 UINT64_C(11400714785074694791)
+#define HASH_P2 UINT64_C(14029467366897019727)
+#define HASH_P3 UINT64_C(1609587929392839161)
+#define HASH_P4 UINT64_C(9650029242287828579)
+#define HASH_P5 UINT64_C(2870177450012600261)
+
+typedef struct tagHASH {
+    uint64_t lane[4];
+    uint64_t length;
+    uint8_t pending[32];        /* bytes of an incomplete stripe */
+    unsigned int pending_count;
+} HASH;
+
+static uint64_t hash_rotl(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t hash_read64(const uint8_t *ptr)
+{
+    return (uint64_t)ptr[0] | ((uint64_t)ptr[1] << 8) | ((uint64_t)ptr[2] << 16) | ((uint64_t)ptr[3] << 24)
+           | ((uint64_t)ptr[4] << 32) | ((uint64_t)ptr[5] << 40) | ((uint64_t)ptr[6] << 48) | ((uint64_t)ptr[7] << 56);
+}
+
+static uint64_t hash_round(uint64_t acc, uint64_t value)
+{
+    return hash_rotl(acc + value * HASH_P2, 31) * HASH_P1;
+}
+
+static void hash_init(HASH *hash)
+{
+    hash->lane[0] = HASH_P1 + HASH_P2;
+    hash->lane[1] = HASH_P2;
+    hash->lane[2] = 0;
+    hash->lane[3] = 0 - HASH_P1;
+    hash->length = 0;
+    hash->pending_count = 0;
+}
+
+static void hash_stripe(HASH *hash, const uint8_t *ptr)
+{
+    for (int idx = 0; idx < 4; idx++)
+        hash->lane[idx] = hash_round(hash->lane[idx], hash_read64(ptr + 8 * idx));
+}
+
+static void hash_update(HASH *hash, const void *data, size_t size)
+{
+    const uint8_t *ptr = (const uint8_t *)data;
+    hash->length += size;
+    if (hash->pending_count > 0) {
+        while (hash->pending_count < 32 && size > 0) {
+            hash->pending[hash->pending_count++] = *ptr++;
+            size--;
+        }
+        if (hash->pending_count < 32)
+            return;
+        hash_stripe(hash, hash->pending);
+        hash->pending_count = 0;
+    }
+    while (size >= 32) {
+        hash_stripe(hash, ptr);
+        ptr += 32;
+        size -= 32;
+    }
+    memcpy(hash->pending, ptr, size);
+    hash->pending_count = size;
+}
+
+static uint64_t hash_final(const HASH *hash)
+{
+    uint64_t h;
+    if (hash->length >= 32) {
+        h = hash_rotl(hash->lane[0], 1) + hash_rotl(hash->lane[1], 7)
+            + hash_rotl(hash->lane[2], 12) + hash_rotl(hash->lane[3], 18);
+        for (int idx = 0; idx < 4; idx++) {
+            h ^= hash_round(0, hash->lane[idx]);
+            h = h * HASH_P1 + HASH_P4;
+        }
+    } else {
+        h = HASH_P5;
+    }
+    h += hash->length;
+    const uint8_t *ptr = hash->pending;
+    unsigned int count = hash->pending_count;
+    for ( ; count >= 8; ptr += 8, count -= 8) {
+        h ^= hash_round(0, hash_read64(ptr));
+        h = hash_rotl(h, 27) * HASH_P1 + HASH_P4;
+    }
+    if (count >= 4) {
+        h ^= (uint64_t)((uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24)) * HASH_P1;
+        h = hash_rotl(h, 23) * HASH_P2 + HASH_P3;
+        ptr += 4;
+        count -= 4;
+    }
+    for ( ; count > 0; ptr++, count--) {
+        h ^= *ptr * HASH_P5;
+        h = hash_rotl(h, 11) * HASH_P1;
+    }
+    h ^= h >> 33;
+    h *= HASH_P2;
+    h ^= h >> 29;
+    h *= HASH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+/* Minimal portable threads, for running jobs in parallel. */
+#if defined _WIN32
+    typedef HANDLE THREAD;
+#   define THREAD_FUNC(name)    static unsigned __stdcall name(void *arg)
+#   define THREAD_RETURN        return 0
+#else
+    typedef pthread_t THREAD;
+#   define THREAD_FUNC(name)    static void *name(void *arg)
+#   define THREAD_RETURN        return NULL
+#endif
+
+#if defined _WIN32
+static bool thread_start(THREAD *thread, unsigned (__stdcall *func)(void *), void *arg)
+{
+    *thread = (HANDLE)_beginthreadex(NULL, 0, func, arg, 0, NULL);
+    return *thread != 0;
+}
+
+static void thread_join(THREAD thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+#else
+static bool thread_start(THREAD *thread, void *(*func)(void *), void *arg)
+{
+    return pthread_create(thread, NULL, func, arg) == 0;
+}
+
+static void thread_join(THREAD thread)
+{
+    pthread_join(thread, NULL);
+}
+#endif
+
+/* A monitor is a mutex with a condition variable, for the queue of requests
+   in worker mode. */
+#if defined _WIN32
+typedef struct tagMONITOR {
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE cond;
+} MONITOR;
+
+static void monitor_init(MONITOR *monitor)
+{
+    InitializeCriticalSection(&monitor->lock);
+    InitializeConditionVariable(&monitor->cond);
+}
+
+static void monitor_destroy(MONITOR *monitor)
+{
+    DeleteCriticalSection(&monitor->lock);
+}
+
+static void monitor_enter(MONITOR *monitor)
+{
+    EnterCriticalSection(&monitor->lock);
+}
+
+static void monitor_leave(MONITOR *monitor)
+{
+    LeaveCriticalSection(&monitor->lock);
+}
+
+static void monitor_wait(MONITOR *monitor)
+{
+    SleepConditionVariableCS(&monitor->cond, &monitor->lock, INFINITE);
+}
+
+static void monitor_notify(MONITOR *monitor, bool all)
+{
+    if (all)
+        WakeAllConditionVariable(&monitor->cond);
+    else
+        WakeConditionVariable(&monitor->cond);
+}
+#else
+typedef struct tagMONITOR {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} MONITOR;
+
+static void monitor_init(MONITOR *monitor)
+{
+    pthread_mutex_init(&monitor->lock, NULL);
+    pthread_cond_init(&monitor->cond, NULL);
+}
+
+static void monitor_destroy(MONITOR *monitor)
+{
+    pthread_cond_destroy(&monitor->cond);
+    pthread_mutex_destroy(&monitor->lock);
+}
+
+static void monitor_enter(MONITOR *monitor)
+{
+    pthread_mutex_lock(&monitor->lock);
+}
+
+static void monitor_leave(MONITOR *monitor)
+{
+    pthread_mutex_unlock(&monitor->lock);
+}
+
+static void monitor_wait(MONITOR *monitor)
+{
+    pthread_cond_wait(&monitor->cond, &monitor->lock);
+}
+
+static void monitor_notify(MONITOR *monitor, bool all)
+{
+    if (all)
+        pthread_cond_broadcast(&monitor->cond);
+    else
+        pthread_cond_signal(&monitor->cond);
+}
+#endif
+
+static unsigned int cpu_count(void)
+{
+#if defined _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#elif defined _SC_NPROCESSORS_ONLN
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (unsigned int)count : 1;
+#else
+    return 1;
+#endif
+}
+
+/* A job formats a block of data into its own text buffer; jobs for
+   consecutive blocks run in parallel, and the texts are written in order. */
+typedef struct tagJOB {
+    const uint8_t *data;
+    size_t size;
+    uint64_t offset;
+    unsigned int bitsize;
+    bool big_endian;
+    char *text;
+    size_t length;
+    THREAD thread;
+    bool running;
+} JOB;
+
+THREAD_FUNC(job_format)
+{
+    JOB *job = (JOB *)arg;
+    job->length = format_words(job->text, job->data, job->size, job->bitsize, job->big_endian,
+                               job->offset) - job->text;
+    THREAD_RETURN;
+}
+
+enum {
+    FORMAT_ARRAY,       /* C array with hexadecimal values */
+    FORMAT_INCBIN,      /* assembler file with .incbin, plus a header */
+    FORMAT_EMBED,       /* C array with #embed */
+    FORMAT_STRING,      /* C array initialized with string literals */
+};
+
+/* The emitter formats the data of the array in portions of arbitrary size; an
+   incomplete word at the end of a portion is held until the next call (or
+   padded with zero bytes by emit_finish()). */
+typedef struct tagEMITTER {
+    OUTPUT *out;
+    unsigned int bitsize;
+    bool big_endian;
+    uint64_t offset;            /* number of bytes emitted so far */
+    uint8_t carry[8];           /* bytes of an incomplete word */
+    unsigned int carry_count;
+    unsigned int jobs;          /* number of threads for formatting */
+    JOB *joblist;
+    OUTPUT *blob;               /* if set, the raw data is written to this file */
+    int format;
+    unsigned int column;        /* string format: characters in the current literal */
+    bool short_octal;           /* string format: last escape was an octal of < 3 digits */
+    bool sparse;                /* array format: use designated initializers for runs */
+    bool written;               /* sparse: whether any element was written */
+    uint64_t next_index;        /* sparse: index that follows the last element written */
+    uint8_t fill[8];            /* sparse: value of the current run of equal elements */
+    uint64_t fill_start;        /* sparse: index of the first element of the run */
+    uint64_t fill_count;        /* sparse: number of elements in the run */
+} EMITTER;
+
+static void emit_init(EMITTER *emit, OUTPUT *out, int format, unsigned int bitsize,
+                      bool big_endian, unsigned int jobs)
+{
+    assert(bitsize == 8 || bitsize == 16 || bitsize == 32 || bitsize == 64);
+    assert(format != FORMAT_STRING || bitsize == 8);
+    assert(jobs >= 1);
+    emit->out = out;
+    emit->format = format;
+    emit->column = 0;
+    emit->short_octal = false;
+    emit->sparse = false;
+    emit->written = false;
+    emit->next_index = 0;
+    emit->fill_count = 0;
+    emit->bitsize = bitsize;
+    emit->big_endian = big_endian;
+    emit->offset = 0;
+    emit->carry_count = 0;
+    emit->jobs = jobs;
+    emit->joblist = NULL;
+    emit->blob = NULL;
+    if (jobs > 1 && format == FORMAT_ARRAY) {
+        emit->joblist = calloc(jobs, sizeof(JOB));
+        if (emit->joblist == NULL)
+            fatal("Memory allocation error.");
+        for (unsigned int idx = 0; idx < jobs; idx++) {
+            emit->joblist[idx].text = malloc(FORMAT_SIZE(JOB_BLOCK));
+            if (emit->joblist[idx].text == NULL)
+                fatal("Memory allocation error.");
+        }
+    }
+}
+
+/* emit_parallel() formats a block of whole rows, which is split over the
+   jobs; it returns the number of bytes that it handled */
+static size_t emit_parallel(EMITTER *emit, const uint8_t *buf, size_t size)
+{
+    assert(emit->jobs > 1 && emit->joblist != NULL);
+    if (size > (size_t)emit->jobs * JOB_BLOCK)
+        size = (size_t)emit->jobs * JOB_BLOCK;
+    size_t chunk = (size / emit->jobs) & ~(size_t)(ROW_BYTES - 1);
+    assert(chunk > 0 && chunk <= JOB_BLOCK);
+    for (unsigned int idx = 0; idx < emit->jobs; idx++) {
+        JOB *job = &emit->joblist[idx];
+        job->data = buf + idx * chunk;
+        job->size = chunk;
+        job->offset = emit->offset + idx * chunk;
+        job->bitsize = emit->bitsize;
+        job->big_endian = emit->big_endian;
+        /* the last job runs on the current thread, as do jobs for which no
+           thread could be created */
+        job->running = (idx + 1 < emit->jobs) && thread_start(&job->thread, job_format, job);
+    }
+    for (unsigned int idx = 0; idx < emit->jobs; idx++) {
+        JOB *job = &emit->joblist[idx];
+        if (!job->running)
+            job_format(job);
+    }
+    /* all threads are joined before the texts are written, because a write
+       error ends the conversion */
+    for (unsigned int idx = 0; idx < emit->jobs; idx++) {
+        JOB *job = &emit->joblist[idx];
+        if (job->running)
+            thread_join(job->thread);
+        job->running = false;
+    }
+    for (unsigned int idx = 0; idx < emit->jobs; idx++)
+        output_write(emit->out, emit->joblist[idx].text, emit->joblist[idx].length);
+    emit->offset += chunk * emit->jobs;
+    return chunk * emit->jobs;
+}
+
+/* Data in string literals is broken into lines; each line is a separate literal
+   (which the compiler concatenates), so that the source lines stay short.
+   Concatenated literals still form a single string, and Microsoft Visual C/C++
+   rejects strings of more than 65535 bytes (including the terminating zero);
+   larger data must be split in sub-arrays (option --split). */
+#define STRING_COLUMNS  76
+#define STRING_MAX      65535
+
+/* format_string() formats the bytes as the contents of string literals; escape
+   sequences are chosen so that the result is the same in C and C++ (octal
+   escapes, because hex escapes do not have a maximum length) */
+static char *format_string(EMITTER *emit, char *ptr, const uint8_t *buf, size_t size)
+{
+    static const char digits[] = "01234567";
+    for (size_t idx = 0; idx < size; idx++) {
+        if (emit->column == 0) {
+            memcpy(ptr, "\n\t\"", 3);
+            ptr += 3;
+            emit->column = 1;
+        }
+        uint8_t c = buf[idx];
+        char *start = ptr;
+        bool octal = false;
+        switch (c) {
+        case '\n':
+            memcpy(ptr, "\\n", 2);
+            ptr += 2;
+            break;
+        case '\t':
+            memcpy(ptr, "\\t", 2);
+            ptr += 2;
+            break;
+        case '\r':
+            memcpy(ptr, "\\r", 2);
+            ptr += 2;
+            break;
+        case '"':
+        case '\\':
+        case '?':       /* to avoid trigraphs */
+            *ptr++ = '\\';
+            *ptr++ = (char)c;
+            break;
+        default:
+            if (c >= ' ' && c < 0x7f && !(emit->short_octal && c >= '0' && c <= '7')) {
+                *ptr++ = (char)c;
+            } else {
+                /* the shortest octal escape, but a digit that follows an octal
+                   escape is itself escaped */
+                *ptr++ = '\\';
+                if (c >= 0100)
+                    *ptr++ = digits[c >> 6];
+                if (c >= 010)
+                    *ptr++ = digits[(c >> 3) & 7];
+                *ptr++ = digits[c & 7];
+                octal = (c < 0100);
+            }
+        }
+        emit->short_octal = octal;
+        emit->column += ptr - start;
+        if (c == '\n' || emit->column >= STRING_COLUMNS) {
+            *ptr++ = '"';
+            emit->column = 0;
+            emit->short_octal = false;
+        }
+    }
+    return ptr;
+}
+
+/* In sparse mode, runs of at least SPARSE_RUN equal elements are not written
+   element by element: a run of zeros is left out (the elements that follow get
+   a designator for their index, and the elements at the end of the array are
+   zero-initialized anyway), and a run of another value gets a range designator
+   (a GNU extension). */
+#define SPARSE_RUN      16
+
+/* sparse_flush() writes the pending run of equal elements */
+static void sparse_flush(EMITTER *emit)
+{
+    unsigned int wordsize = emit->bitsize >> 3;
+    uint64_t index = emit->fill_start;
+    if (emit->fill_count >= SPARSE_RUN) {
+        static const uint8_t zeros[8];
+        if (memcmp(emit->fill, zeros, wordsize) != 0) {
+            char *ptr = output_reserve(emit->out, 96);
+            ptr += sprintf(ptr, "%s\n\t[%" PRIu64 " ... %" PRIu64 "] = ", emit->written ? "," : "",
+                           index, index + emit->fill_count - 1);
+            ptr = format_word(ptr, emit->fill, wordsize, emit->big_endian);
+            emit->out->pos = ptr - emit->out->buffer;
+            emit->next_index = index + emit->fill_count;
+            emit->written = true;
+        }
+        emit->fill_count = 0;
+        return;
+    }
+    for (uint64_t count = 0; count < emit->fill_count; count++, index++) {
+        char *ptr = output_reserve(emit->out, 96);
+        if (index != emit->next_index) {
+            ptr += sprintf(ptr, "%s\n\t[%" PRIu64 "] = ", emit->written ? "," : "", index);
+        } else {
+            if (emit->written) {
+                *ptr++ = ',';
+                *ptr++ = ' ';
+            }
+            if ((index * wordsize) % ROW_BYTES == 0) {
+                *ptr++ = '\n';
+                *ptr++ = '\t';
+            }
+        }
+        ptr = format_word(ptr, emit->fill, wordsize, emit->big_endian);
+        emit->out->pos = ptr - emit->out->buffer;
+        emit->next_index = index + 1;
+        emit->written = true;
+    }
+    emit->fill_count = 0;
+}
+
+/* emit_sparse() collects the words in runs of equal elements */
+static void emit_sparse(EMITTER *emit, const uint8_t *buf, size_t size)
+{
+    unsigned int wordsize = emit->bitsize >> 3;
+    while (size > 0) {
+        const uint8_t *word = buf;
+        if (emit->carry_count > 0 || size < wordsize) {
+            while (emit->carry_count < wordsize && size > 0) {
+                emit->carry[emit->carry_count++] = *buf++;
+                size--;
+            }
+            if (emit->carry_count < wordsize)
+                return;
+            word = emit->carry;
+            emit->carry_count = 0;
+        } else {
+            buf += wordsize;
+            size -= wordsize;
+        }
+        if (emit->fill_count > 0 && memcmp(word, emit->fill, wordsize) == 0) {
+            emit->fill_count++;
+        } else {
+            sparse_flush(emit);
+            memcpy(emit->fill, word, wordsize);
+            emit->fill_start = emit->offset / wordsize;
+            emit->fill_count = 1;
+        }
+        emit->offset += wordsize;
+    }
+}
+
+static void emit_block(EMITTER *emit, const uint8_t *buf, size_t size)
+{
+    unsigned int wordsize = emit->bitsize >> 3;
+    if (emit->blob != NULL) {
+        stats_enter(PHASE_WRITE);
+        output_write(emit->blob, (const char *)buf, size);
+        stats_leave();
+        emit->offset += size;
+        return;
+    }
+    if (emit->format == FORMAT_STRING) {
+        /* at most 6 characters per byte: a newline is "\n", and it ends the
+           line, after which the next line starts with a newline, a tab and a
+           quote; plus the start and the end of a line in the block */
+        const size_t blocksize = OUTPUT_BLOCK / 8;
+        while (size > 0) {
+            size_t count = (size > blocksize) ? blocksize : size;
+            char *ptr = output_reserve(emit->out, count * 6 + 8);
+            emit->out->pos = format_string(emit, ptr, buf, count) - emit->out->buffer;
+            emit->offset += count;
+            buf += count;
+            size -= count;
+        }
+        return;
+    }
+    if (emit->sparse) {
+        emit_sparse(emit, buf, size);
+        return;
+    }
+    if (emit->carry_count > 0) {
+        while (emit->carry_count < wordsize && size > 0) {
+            emit->carry[emit->carry_count++] = *buf++;
+            size--;
+        }
+        if (emit->carry_count < wordsize)
+            return;
+        char *ptr = output_reserve(emit->out, FORMAT_SIZE(wordsize));
+        emit->out->pos = format_words(ptr, emit->carry, wordsize, emit->bitsize, emit->big_endian,
+                                     emit->offset) - emit->out->buffer;
+        emit->offset += wordsize;
+        emit->carry_count = 0;
+    }
+    const size_t blocksize = (OUTPUT_BLOCK / 8) & ~(size_t)(ROW_BYTES - 1);
+    while (size >= wordsize) {
+        if (emit->jobs > 1 && size >= (size_t)emit->jobs * blocksize
+            && (emit->offset & (ROW_BYTES - 1)) == 0)
+        {
+            size_t count = emit_parallel(emit, buf, size);
+            buf += count;
+            size -= count;
+            continue;
+        }
+        size_t count = (size > blocksize) ? blocksize : size;
+        if (emit->jobs > 1 && (emit->offset & (ROW_BYTES - 1)) != 0
+            && count > ROW_BYTES - (emit->offset & (ROW_BYTES - 1)))
+            count = ROW_BYTES - (emit->offset & (ROW_BYTES - 1)); /* go to a row boundary first */
+        count -= count % wordsize;
+        char *ptr = output_reserve(emit->out, FORMAT_SIZE(count));
+        emit->out->pos = format_words(ptr, buf, count, emit->bitsize, emit->big_endian,
+                                     emit->offset) - emit->out->buffer;
+        emit->offset += count;
+        buf += count;
+        size -= count;
+    }
+    memcpy(emit->carry, buf, size);
+    emit->carry_count = size;
+}
+
+/* emit_data() formats a portion of the data (or writes it to the blob file) */
+static void emit_data(EMITTER *emit, const uint8_t *buf, size_t size)
+{
+    stats_enter(PHASE_FORMAT);
+    emit_block(emit, buf, size);
+    stats_leave();
+}
+
+/* emit_free() releases the buffers of the emitter, without writing anything
+   (emit_finish() calls it) */
+static void emit_free(EMITTER *emit)
+{
+    if (emit->joblist != NULL) {
+        for (unsigned int idx = 0; idx < emit->jobs; idx++)
+            free(emit->joblist[idx].text);
+        free(emit->joblist);
+        emit->joblist = NULL;
+    }
+}
+
+static void emit_finish(EMITTER *emit)
+{
+    emit_free(emit);
+    if (emit->format == FORMAT_STRING) {
+        if (emit->column > 0)
+            output_printf(emit->out, "\"");
+        else if (emit->offset == 0)
+            output_printf(emit->out, "\n\t\"\"");   /* empty file */
+        emit->column = 0;
+        return;
+    }
+    if (emit->blob != NULL) {
+        /* pad raw data to a whole number of words */
+        static const char zeros[8];
+        size_t count = (size_t)(-emit->offset & ((emit->bitsize >> 3) - 1));
+        output_write(emit->blob, zeros, count);
+        emit->offset += count;
+    }
+    if (emit->sparse) {
+        if (emit->carry_count > 0) {
+            unsigned int wordsize = emit->bitsize >> 3;
+            uint64_t offset = emit->offset + emit->carry_count;
+            memset(emit->carry + emit->carry_count, 0, wordsize - emit->carry_count);
+            emit->carry_count = 0;
+            emit_sparse(emit, emit->carry, wordsize);
+            emit->offset = offset;
+        }
+        sparse_flush(emit);
+        if (!emit->written)
+            output_printf(emit->out, "\n\t0");  /* an initializer list may not be empty */
+        return;
+    }
+    if (emit->carry_count > 0) {
+        unsigned int wordsize = emit->bitsize >> 3;
+        memset(emit->carry + emit->carry_count, 0, wordsize - emit->carry_count);
+        char *ptr = output_reserve(emit->out, FORMAT_SIZE(wordsize));
+        emit->out->pos = format_words(ptr, emit->carry, wordsize, emit->bitsize, emit->big_endian,
+                                     emit->offset) - emit->out->buffer;
+        emit->offset += emit->carry_count;
+        emit->carry_count = 0;
+    }
+}
+
+/* Compression codecs; each codec is only available if support for it is
+   compiled in (with USE_BZ2, USE_ZLIB, USE_LZ4 or USE_ZSTD). The identifiers
+   are emitted in the generated file, for the decompression code to check. */
+enum {
+    CODEC_NONE,
+    CODEC_BZ2,
+    CODEC_DEFLATE,
+    CODEC_LZ4,
+    CODEC_ZSTD,
+    CODEC_COUNT
+};
+
+/* The data is compressed as a stream: it is passed to the compressor in
+   portions, and the compressed output is sent to the emitter each time the
+   output buffer fills up. Therefore, neither the complete input nor the
+   complete compressed data needs to be held in memory. Optionally, the data
+   is split into blocks that are compressed independently (so that a block can
+   be decompressed without decompressing any data before it); the offsets of
+   the blocks in the compressed data are collected in an index. Independent
+   blocks can also be compressed in parallel: the input is then gathered in a
+   batch of one block per job, each job compresses its block into memory, and
+   the results are emitted in order. */
+#define STREAM_BLOCK    (64 * 1024)     /* input bytes per compression step */
+
+struct tagCODEC;
+struct tagCJOB;
+
+typedef struct tagSTREAM {
+    void *context;              /* codec-specific state */
+    uint8_t *buffer;            /* output buffer */
+    size_t bufsize;
+    EMITTER *emit;              /* destination of the compressed data */
+    uint64_t total;             /* number of compressed bytes so far */
+    const struct tagCODEC *codec;
+    int level;
+    uint64_t size;              /* total input size */
+    uint64_t position;          /* number of input bytes so far */
+    uint64_t block_end;         /* input position where the current block ends */
+    size_t block_size;          /* 0 if the data is compressed as a single block */
+    bool active;                /* whether a block is in progress */
+    uint32_t *index;            /* offsets of the blocks (NULL for a single block) */
+    unsigned int blocks;        /* number of blocks that were completed */
+    uint8_t *mem;               /* destination of the compressed data if there */
+    size_t mem_size;            /* is no emitter (for compression jobs) */
+    size_t mem_capacity;
+    unsigned int jobs;          /* number of blocks that are compressed in parallel */
+    struct tagCJOB *joblist;
+    uint8_t *batch;             /* input for the jobs */
+    size_t batch_fill;
+} STREAM;
+
+/* A compression job compresses a single block into memory. */
+typedef struct tagCJOB {
+    STREAM stream;
+    const uint8_t *data;
+    size_t size;
+    bool failed;
+    FAILURE fail;               /* error raised in the job (if any) */
+    THREAD thread;
+    bool running;
+} CJOB;
+
+typedef struct tagCODEC {
+    const char *name;
+    const char *macro;          /* identifier in the generated file */
+    int min_level, max_level, default_level;
+    /* init() sets up the context and the output buffer, "size" is the total
+       size of the input; write() compresses a portion of the input, and with
+       "finish" set, it also flushes the end of the stream; end() frees the
+       context; init() and write() return false on failure */
+    bool (*init)(STREAM *stream, int level, uint64_t size);
+    bool (*write)(STREAM *stream, const uint8_t *src, size_t size, bool finish);
+    void (*end)(STREAM *stream);
+} CODEC;
+
+#if defined USE_BZ2 || defined USE_ZLIB || defined USE_LZ4 || defined USE_ZSTD
+/* In worker mode, a thread that runs requests keeps the compression context
+   of a codec when a stream ends, and resets it for the next stream (instead of
+   creating a new context); bz2 has no reset, so it gets a new context always.
+   Compression jobs do not keep contexts, as their threads end. */
+static THREAD_LOCAL void *warm_context[CODEC_COUNT];
+
+static void *take_context(int codec)
+{
+    void *context = warm_context[codec];
+    warm_context[codec] = NULL;
+    return context;
+}
+
+static bool keep_context(int codec, void *context)
+{
+    if (!in_request() || warm_context[codec] != NULL)
+        return false;   /* not running a request, or already holding one */
+    warm_context[codec] = context;
+    return true;
+}
+
+static void stream_alloc(STREAM *stream, size_t bufsize)
+{
+    if (stream->buffer != NULL)
+        return;     /* buffer is kept from the previous block */
+    stream->bufsize = bufsize;
+    stream->buffer = malloc(bufsize);
+    if (stream->buffer == NULL)
+        fatal("Memory allocation error.");
+}
+
+static void stream_emit(STREAM *stream, size_t size)
+{
+    if (size == 0)
+        return;
+    if (stream->emit != NULL) {
+        emit_data(stream->emit, stream->buffer, size);
+    } else {
+        if (stream->mem_size + size > stream->mem_capacity) {
+            size_t capacity = 2 * stream->mem_capacity + size;
+            uint8_t *mem = realloc(stream->mem, capacity);
+            if (mem == NULL)
+                fatal("Memory allocation error.");
+            stream->mem = mem;
+            stream->mem_capacity = capacity;
+        }
+        memcpy(stream->mem + stream->mem_size, stream->buffer, size);
+        stream->mem_size += size;
+    }
+    stream->total += size;
+}
+#endif
+
+#ifdef USE_BZ2
+static bool bz2_init(STREAM *stream, int level, uint64_t size)
+{
+    (void)size;
+    bz_stream *bz = calloc(1, sizeof(bz_stream));
+    if (bz == NULL)
+        fatal("Memory allocation error.");
+    stream->context = bz;
+    stream_alloc(stream, STREAM_BLOCK);
+    return BZ2_bzCompressInit(bz, level, 0, 0) == BZ_OK;
+}
+
+static bool bz2_write(STREAM *stream, const uint8_t *src, size_t size, bool finish)
+{
+    bz_stream *bz = stream->context;
+    for ( ;; ) {
+        /* the input count is an unsigned int, so it is passed in portions */
+        size_t count = (size > STREAM_BLOCK) ? STREAM_BLOCK : size;
+        bz->next_in = (char *)src;
+        bz->avail_in = (unsigned int)count;
+        bool last = finish && count == size;
+        int status;
+        do {
+            bz->next_out = (char *)stream->buffer;
+            bz->avail_out = (unsigned int)stream->bufsize;
+            status = BZ2_bzCompress(bz, last ? BZ_FINISH : BZ_RUN);
+            if (status != BZ_RUN_OK && status != BZ_FINISH_OK && status != BZ_STREAM_END)
+                return false;
+            stream_emit(stream, stream->bufsize - bz->avail_out);
+        } while (last ? status != BZ_STREAM_END : bz->avail_in > 0);
+        src += count;
+        size -= count;
+        if (size == 0)
+            return true;
+    }
+}
+
+static void bz2_end(STREAM *stream)
+{
+    BZ2_bzCompressEnd(stream->context);
+    free(stream->context);
+}
+#endif
+
+#ifdef USE_ZLIB
+static bool deflate_init(STREAM *stream, int level, uint64_t size)
+{
+    (void)size;
+    z_stream *zs = take_context(CODEC_DEFLATE);
+    if (zs != NULL) {
+        stream->context = zs;
+        stream_alloc(stream, STREAM_BLOCK);
+        return deflateReset(zs) == Z_OK && deflateParams(zs, level, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    zs = calloc(1, sizeof(z_stream));
+    if (zs == NULL)
+        fatal("Memory allocation error.");
+    stream->context = zs;
+    stream_alloc(stream, STREAM_BLOCK);
+    return deflateInit(zs, level) == Z_OK;
+}
+
+static bool deflate_write(STREAM *stream, const uint8_t *src, size_t size, bool finish)
+{
+    z_stream *zs = stream->context;
+    for ( ;; ) {
+        size_t count = (size > STREAM_BLOCK) ? STREAM_BLOCK : size;
+        zs->next_in = (Bytef *)src;
+        zs->avail_in = (uInt)count;
+        bool last = finish && count == size;
+        int status;
+        do {
+            zs->next_out = stream->buffer;
+            zs->avail_out = (uInt)stream->bufsize;
+            status = deflate(zs, last ? Z_FINISH : Z_NO_FLUSH);
+            if (status != Z_OK && status != Z_BUF_ERROR && status != Z_STREAM_END)
+                return false;
+            stream_emit(stream, stream->bufsize - zs->avail_out);
+        } while (last ? status != Z_STREAM_END : zs->avail_out == 0);
+        src += count;
+        size -= count;
+        if (size == 0)
+            return true;
+    }
+}
+
+static void deflate_end(STREAM *stream)
+{
+    if (keep_context(CODEC_DEFLATE, stream->context))
+        return;
+    deflateEnd(stream->context);
+    free(stream->context);
+}
+#endif
+
+#ifdef USE_LZ4
+static bool lz4_init(STREAM *stream, int level, uint64_t size)
+{
+    LZ4F_cctx *cctx = take_context(CODEC_LZ4);
+    if (cctx == NULL && LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION)))
+        return false;
+    stream->context = cctx;     /* LZ4F_compressBegin() resets a context that is reused */
+    LZ4F_preferences_t prefs;
+    memset(&prefs, 0, sizeof prefs);
+    prefs.compressionLevel = level;
+    prefs.frameInfo.contentSize = size;
+    /* the output buffer must hold the worst case for a full input block */
+    stream_alloc(stream, LZ4F_compressBound(STREAM_BLOCK, &prefs));
+    size_t count = LZ4F_compressBegin(cctx, stream->buffer, stream->bufsize, &prefs);
+    if (LZ4F_isError(count))
+        return false;
+    stream_emit(stream, count);
+    return true;
+}
+
+static bool lz4_write(STREAM *stream, const uint8_t *src, size_t size, bool finish)
+{
+    while (size > 0) {
+        size_t count = (size > STREAM_BLOCK) ? STREAM_BLOCK : size;
+        size_t result = LZ4F_compressUpdate(stream->context, stream->buffer, stream->bufsize, src, count, NULL);
+        if (LZ4F_isError(result))
+            return false;
+        stream_emit(stream, result);
+        src += count;
+        size -= count;
+    }
+    if (finish) {
+        size_t result = LZ4F_compressEnd(stream->context, stream->buffer, stream->bufsize, NULL);
+        if (LZ4F_isError(result))
+            return false;
+        stream_emit(stream, result);
+    }
+    return true;
+}
+
+static void lz4_end(STREAM *stream)
+{
+    if (!keep_context(CODEC_LZ4, stream->context))
+        LZ4F_freeCompressionContext(stream->context);
+}
+#endif
+
+#ifdef USE_ZSTD
+static bool zstd_init(STREAM *stream, int level, uint64_t size)
+{
+    ZSTD_CCtx *cctx = take_context(CODEC_ZSTD);
+    if (cctx != NULL)
+        ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+    else if ((cctx = ZSTD_createCCtx()) == NULL)
+        fatal("Memory allocation error.");
+    stream->context = cctx;
+    stream_alloc(stream, ZSTD_CStreamOutSize());
+    /* with the size pledged, it is stored in the frame header */
+    return !ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level))
+           && !ZSTD_isError(ZSTD_CCtx_setPledgedSrcSize(cctx, size));
+}
+
+static bool zstd_write(STREAM *stream, const uint8_t *src, size_t size, bool finish)
+{
+    ZSTD_inBuffer input = { src, size, 0 };
+    size_t remaining;
+    do {
+        ZSTD_outBuffer output = { stream->buffer, stream->bufsize, 0 };
+        remaining = ZSTD_compressStream2(stream->context, &output, &input, finish ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError(remaining))
+            return false;
+        stream_emit(stream, output.pos);
+    } while (finish ? remaining > 0 : input.pos < input.size);
+    return true;
+}
+
+static void zstd_end(STREAM *stream)
+{
+    if (!keep_context(CODEC_ZSTD, stream->context))
+        ZSTD_freeCCtx(stream->context);
+}
+#endif
+
+static const CODEC codecs[CODEC_COUNT] = {
+    { "none",    "BIN2C_CODEC_NONE",    0, 0, 0,  NULL, NULL, NULL },
+#ifdef USE_BZ2
+    { "bz2",     "BIN2C_CODEC_BZ2",     1, 9, 9,  bz2_init, bz2_write, bz2_end },
+#else
+    { "bz2",     "BIN2C_CODEC_BZ2",     1, 9, 9,  NULL, NULL, NULL },
+#endif
+#ifdef USE_ZLIB
+    { "deflate", "BIN2C_CODEC_DEFLATE", 0, 9, 9,  deflate_init, deflate_write, deflate_end },
+#else
+    { "deflate", "BIN2C_CODEC_DEFLATE", 0, 9, 9,  NULL, NULL, NULL },
+#endif
+#ifdef USE_LZ4
+    { "lz4",     "BIN2C_CODEC_LZ4",     0, 12, 9, lz4_init, lz4_write, lz4_end },
+#else
+    { "lz4",     "BIN2C_CODEC_LZ4",     0, 12, 9, NULL, NULL, NULL },
+#endif
+#ifdef USE_ZSTD
+    { "zstd",    "BIN2C_CODEC_ZSTD",    1, 22, 19, zstd_init, zstd_write, zstd_end },
+#else
+    { "zstd",    "BIN2C_CODEC_ZSTD",    1, 22, 19, NULL, NULL, NULL },
+#endif
+};
+
+/* the default is bzip2 compression when it is compiled in (this was the only
+   codec in earlier versions, where it could not be switched off) */
+#ifdef USE_BZ2
+#   define DEFAULT_CODEC    CODEC_BZ2
+#else
+#   define DEFAULT_CODEC    CODEC_NONE
+#endif
+
+/* stream_open() starts compressing with the codec, the compressed data goes to
+   the emitter; "size" is the total number of bytes that will be passed to
+   stream_write(), "block_size" is 0 for compressing the data as a whole, and
+   "jobs" is the number of blocks to compress in parallel */
+static void stream_open(STREAM *stream, const CODEC *codec, int level, uint64_t size,
+                        size_t block_size, unsigned int jobs, EMITTER *emit)
+{
+    memset(stream, 0, sizeof(STREAM));
+    stream->codec = codec;
+    stream->level = level;
+    stream->size = size;
+    stream->block_size = block_size;
+    stream->emit = emit;
+    if (block_size > 0) {
+        uint64_t count = (size + block_size - 1) / block_size;
+        if (count == 0)
+            count = 1;  /* an empty file still has a (empty) block */
+        if (count >= UINT_MAX)
+            fatal("Too many blocks (increase the block size).");
+        stream->index = malloc((size_t)(count + 1) * sizeof(uint32_t));
+        if (stream->index == NULL)
+            fatal("Memory allocation error.");
+        stream->index[0] = 0;
+        if (jobs > count)
+            jobs = (unsigned int)count;
+        if (jobs > 1) {
+            stream->jobs = jobs;
+            stream->joblist = calloc(jobs, sizeof(CJOB));
+            stream->batch = malloc((size_t)jobs * block_size);
+            if (stream->joblist == NULL || stream->batch == NULL)
+                fatal("Memory allocation error.");
+            for (unsigned int idx = 0; idx < jobs; idx++) {
+                stream->joblist[idx].stream.codec = codec;
+                stream->joblist[idx].stream.level = level;
+            }
+        }
+    }
+}
+
+/* job_compress() compresses the block of a job; an error (from fatal()) is
+   caught, so that the thread that owns the stream can report it after all
+   jobs ended (the job may also run on that thread itself) */
+THREAD_FUNC(job_compress)
+{
+    CJOB *job = (CJOB *)arg;
+    FAILURE *owner = failure;
+    job->fail.worker = (owner != NULL && owner->worker);
+    job->fail.message[0] = '\0';
+    failure = &job->fail;
+    if (setjmp(job->fail.env) == 0) {
+        STREAM *stream = &job->stream;
+        const CODEC *codec = stream->codec;
+        stream->mem_size = 0;
+        stream->total = 0;
+        job->failed = !codec->init(stream, stream->level, job->size);
+        if (!job->failed) {
+            job->failed = !codec->write(stream, job->data, job->size, true);
+            codec->end(stream);
+        }
+    } else {
+        job->failed = true;
+    }
+    failure = owner;
+    THREAD_RETURN;
+}
+
+/* stream_batch() compresses the blocks in the batch in parallel, and emits the
+   compressed blocks in order */
+static void stream_batch(STREAM *stream)
+{
+    unsigned int count = (unsigned int)((stream->batch_fill + stream->block_size - 1) / stream->block_size);
+    if (count == 0)
+        count = 1;  /* an empty file still has a (empty) block */
+    assert(count <= stream->jobs);
+    for (unsigned int idx = 0; idx < count; idx++) {
+        CJOB *job = &stream->joblist[idx];
+        size_t offset = idx * stream->block_size;
+        job->data = stream->batch + offset;
+        job->size = stream->batch_fill - offset;
+        if (job->size > stream->block_size)
+            job->size = stream->block_size;
+        /* the last job runs on the current thread, as do jobs for which no
+           thread could be created */
+        job->running = (idx + 1 < count) && thread_start(&job->thread, job_compress, job);
+    }
+    for (unsigned int idx = 0; idx < count; idx++) {
+        CJOB *job = &stream->joblist[idx];
+        if (!job->running)
+            job_compress(job);
+    }
+    /* all threads must have ended before an error is reported, because they
+       use the buffers of the stream */
+    const CJOB *failed = NULL;
+    for (unsigned int idx = 0; idx < count; idx++) {
+        CJOB *job = &stream->joblist[idx];
+        if (job->running)
+            thread_join(job->thread);
+        job->running = false;
+        if (job->failed && failed == NULL)
+            failed = job;
+    }
+    if (failed != NULL && failed->fail.message[0] != '\0')
+        fatal("%s", failed->fail.message);
+    if (failed != NULL)
+        fatal("Failed to compress data (%s).", stream->codec->name);
+    for (unsigned int idx = 0; idx < count; idx++) {
+        CJOB *job = &stream->joblist[idx];
+        emit_data(stream->emit, job->stream.mem, job->stream.mem_size);
+        stream->total += job->stream.mem_size;
+        stream->blocks++;
+        stream->index[stream->blocks] = (uint32_t)stream->total;
+    }
+    stream->batch_fill = 0;
+}
+
+/* stream_compress() compresses the data, and with "finish" set, it completes
+   the stream; a new block is started when needed */
+static void stream_compress(STREAM *stream, const uint8_t *src, size_t size, bool finish)
+{
+    const CODEC *codec = stream->codec;
+    if (stream->joblist != NULL) {
+        size_t batch_size = (size_t)stream->jobs * stream->block_size;
+        while (size > 0) {
+            size_t count = batch_size - stream->batch_fill;
+            if (count > size)
+                count = size;
+            memcpy(stream->batch + stream->batch_fill, src, count);
+            stream->batch_fill += count;
+            stream->position += count;
+            src += count;
+            size -= count;
+            if (stream->batch_fill == batch_size)
+                stream_batch(stream);
+        }
+        if (finish && (stream->batch_fill > 0 || stream->blocks == 0))
+            stream_batch(stream);
+        return;
+    }
+    while (size > 0 || (finish && (stream->active || stream->blocks == 0))) {
+        if (!stream->active) {
+            uint64_t count = stream->size - stream->position;
+            if (stream->block_size > 0 && count > stream->block_size)
+                count = stream->block_size;
+            if (!codec->init(stream, stream->level, count))
+                fatal("Failed to initialize compression (%s).", codec->name);
+            stream->block_end = stream->position + count;
+            stream->active = true;
+        }
+        size_t count = size;
+        bool end = finish;
+        if (stream->block_size > 0 && count >= stream->block_end - stream->position) {
+            count = (size_t)(stream->block_end - stream->position);
+            end = true;
+        }
+        if ((count > 0 || end) && !codec->write(stream, src, count, end))
+            fatal("Failed to compress data (%s).", codec->name);
+        stream->position += count;
+        src += count;
+        size -= count;
+        if (end) {
+            codec->end(stream);
+            stream->active = false;
+            stream->blocks++;
+            if (stream->index != NULL)
+                stream->index[stream->blocks] = (uint32_t)stream->total;
+        }
+    }
+}
+
+/* stream_write() passes the data through the compressor (see stream_compress()) */
+static void stream_write(STREAM *stream, const uint8_t *src, size_t size, bool finish)
+{
+    stats_enter(PHASE_COMPRESS);
+    stream_compress(stream, src, size, finish);
+    stats_leave();
+}
+
+/* stream_close() frees the buffers, except the index */
+static void stream_close(STREAM *stream)
+{
+    assert(!stream->active && stream->batch_fill == 0);
+    stats.bytes_compressed += stream->total;
+    stats.bytes_compressible += stream->size;
+    if (stream->joblist != NULL) {
+        for (unsigned int idx = 0; idx < stream->jobs; idx++) {
+            free(stream->joblist[idx].stream.buffer);
+            free(stream->joblist[idx].stream.mem);
+        }
+        free(stream->joblist);
+        free(stream->batch);
+        stream->joblist = NULL;
+    }
+    free(stream->buffer);
+    free(stream->mem);
+    stream->buffer = NULL;
+}
+
+/* A header-only helper for decompressing a buffer with any of the codecs; it
+   is emitted once per output file (before the other helpers, which use it),
+   and it only supports the codecs whose header file is included before the
+   generated file. */
+static const char decompress_helper[] =
+    "#ifndef BIN2C_DECOMPRESS\n"
+    "#define BIN2C_DECOMPRESS\n"
+    "#include <stddef.h>\n"
+    "/* bin2c_decompress() decompresses \"srcsize\" bytes of compressed data into\n"
+    "   \"buffer\" (which must be \"size\" bytes); it returns the number of bytes in\n"
+    "   the decompressed data (0 on failure). The header file of the codec must be\n"
+    "   included before this file. */\n"
+    "static inline size_t bin2c_decompress(void *buffer, size_t size, const void *src, size_t srcsize,\n"
+    "                                      unsigned int codec)\n"
+    "{\n"
+    "    switch (codec) {\n"
+    "#if defined BZ_OK\n"
+    "    case BIN2C_CODEC_BZ2: {\n"
+    "        unsigned int length = (unsigned int)size;\n"
+    "        if (BZ2_bzBuffToBuffDecompress((char *)buffer, &length, (char *)src, (unsigned int)srcsize, 0, 0) != BZ_OK)\n"
+    "            return 0;\n"
+    "        return length;\n"
+    "    }\n"
+    "#endif\n"
+    "#if defined Z_OK\n"
+    "    case BIN2C_CODEC_DEFLATE: {\n"
+    "        uLongf length = (uLongf)size;\n"
+    "        if (uncompress((Bytef *)buffer, &length, (const Bytef *)src, (uLong)srcsize) != Z_OK)\n"
+    "            return 0;\n"
+    "        return (size_t)length;\n"
+    "    }\n"
+    "#endif\n"
+    "#if defined LZ4F_VERSION\n"
+    "    case BIN2C_CODEC_LZ4: {\n"
+    "        LZ4F_dctx *dctx;\n"
+    "        size_t length = size, count = srcsize, result;\n"
+    "        if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))\n"
+    "            return 0;\n"
+    "        result = LZ4F_decompress(dctx, buffer, &length, src, &count, 0);\n"
+    "        LZ4F_freeDecompressionContext(dctx);\n"
+    "        return (result == 0) ? length : 0;\n"
+    "    }\n"
+    "#endif\n"
+    "#if defined ZSTD_VERSION_NUMBER\n"
+    "    case BIN2C_CODEC_ZSTD: {\n"
+    "        size_t length = ZSTD_decompress(buffer, size, src, srcsize);\n"
+    "        return ZSTD_isError(length) ? 0 : length;\n"
+    "    }\n"
+    "#endif\n"
+    "    }\n"
+    "    (void)buffer;   /* in case no codec header is included */\n"
+    "    (void)size;\n"
+    "    (void)src;\n"
+    "    (void)srcsize;\n"
+    "    return 0;\n"
+    "}\n"
+    "#endif\n";
+
+/* A header-only helper for reading a single block of data that was compressed
+   in blocks. It is emitted once per output file. */
+static const char read_block_helper[] =
+    "#ifndef BIN2C_READ_BLOCK\n"
+    "#define BIN2C_READ_BLOCK\n"
+    "/* bin2c_read_block() decompresses the block that holds byte \"offset\" of the\n"
+    "   original data, into \"buffer\" (which must be \"block_size\" bytes); it\n"
+    "   returns the number of bytes in the block (0 on failure), and it sets\n"
+    "   \"start\" (if not NULL) to the position of the block in the original data.\n"
+    "   The header file of the codec must be included before this file. */\n"
+    "static inline unsigned int bin2c_read_block(void *buffer, const void *data, const unsigned int *index,\n"
+    "                                            unsigned int block_size, unsigned int size_uncompressed,\n"
+    "                                            unsigned int codec, unsigned int offset, unsigned int *start)\n"
+    "{\n"
+    "    unsigned int block, size;\n"
+    "    if (offset >= size_uncompressed)\n"
+    "        return 0;\n"
+    "    block = offset / block_size;\n"
+    "    size = size_uncompressed - block * block_size;\n"
+    "    if (size > block_size)\n"
+    "        size = block_size;\n"
+    "    if (start != 0)\n"
+    "        *start = block * block_size;\n"
+    "    return (unsigned int)bin2c_decompress(buffer, size, (const char *)data + index[block],\n"
+    "                                          index[block + 1] - index[block], codec);\n"
+    "}\n"
+    "#endif\n";
+
+/* Header-only helpers for the accessors of the symbols (option --accessor),
+   emitted once per output file: a thread-safe decompress-once cache and a
+   streaming reader. */
+static const char accessor_helper[] =
+    "#ifndef BIN2C_ACCESSOR\n"
+    "#define BIN2C_ACCESSOR\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "/* The accessors decompress the data of a symbol once, on first use, and they\n"
+    "   return the same buffer on any later call (from any thread). The header file\n"
+    "   of the codec must be included before this file. */\n"
+    "#if defined _MSC_VER\n"
+    "  #include <intrin.h>\n"
+    "  #define BIN2C_CAS(p, o, n)  (_InterlockedCompareExchange((p), (n), (o)) == (o))\n"
+    "  #define BIN2C_LOAD(p)       _InterlockedOr((p), 0)\n"
+    "  #define BIN2C_STORE(p, v)   (void)_InterlockedExchange((p), (v))\n"
+    "#elif defined __GNUC__\n"
+    "  #define BIN2C_CAS(p, o, n)  __sync_bool_compare_and_swap((p), (o), (n))\n"
+    "  #define BIN2C_LOAD(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)\n"
+    "  #define BIN2C_STORE(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELEASE)\n"
+    "#else\n"
+    "  /* no atomic operations: the first call must not be made from two threads */\n"
+    "  #define BIN2C_CAS(p, o, n)  (*(p) == (o) ? (*(p) = (n), 1) : 0)\n"
+    "  #define BIN2C_LOAD(p)       (*(p))\n"
+    "  #define BIN2C_STORE(p, v)   (void)(*(p) = (v))\n"
+    "#endif\n"
+    "typedef struct bin2c_cache {\n"
+    "    volatile long state;        /* 0 = empty, 1 = being decompressed, 2 = ready */\n"
+    "    void *data;\n"
+    "} bin2c_cache;\n"
+    "/* bin2c_load() returns the decompressed data, after decompressing it into\n"
+    "   \"buffer\" on the first call; \"buffer\" must be \"size_uncompressed\" bytes, or\n"
+    "   NULL to allocate the buffer with malloc(). It returns NULL on failure (and\n"
+    "   a next call tries again). The \"index\" is NULL unless the data was\n"
+    "   compressed in blocks. */\n"
+    "static inline const void *bin2c_load(bin2c_cache *cache, void *buffer, const void *data, size_t size,\n"
+    "                                     const unsigned int *index, size_t block_size,\n"
+    "                                     size_t size_uncompressed, unsigned int codec)\n"
+    "{\n"
+    "    for (;;) {\n"
+    "        long state = BIN2C_LOAD(&cache->state);\n"
+    "        if (state == 2)\n"
+    "            return cache->data;\n"
+    "        if (state == 0 && BIN2C_CAS(&cache->state, 0, 1)) {\n"
+    "            unsigned char *target = (unsigned char *)buffer;\n"
+    "            int ok;\n"
+    "            if (target == 0)\n"
+    "                target = (unsigned char *)malloc((size_uncompressed > 0) ? size_uncompressed : 1);\n"
+    "            ok = (target != 0);\n"
+    "            if (ok && index == 0) {\n"
+    "                ok = (bin2c_decompress(target, size_uncompressed, data, size, codec) == size_uncompressed);\n"
+    "            } else if (ok) {\n"
+    "                size_t block, offset;\n"
+    "                for (block = 0, offset = 0; ok && offset < size_uncompressed; block++, offset += block_size) {\n"
+    "                    size_t length = size_uncompressed - offset;\n"
+    "                    if (length > block_size)\n"
+    "                        length = block_size;\n"
+    "                    ok = (bin2c_decompress(target + offset, length, (const char *)data + index[block],\n"
+    "                                           index[block + 1] - index[block], codec) == length);\n"
+    "                }\n"
+    "            }\n"
+    "            if (!ok) {\n"
+    "                if (target != buffer)\n"
+    "                    free(target);\n"
+    "                BIN2C_STORE(&cache->state, 0);\n"
+    "                return 0;\n"
+    "            }\n"
+    "            cache->data = target;\n"
+    "            BIN2C_STORE(&cache->state, 2);\n"
+    "            return target;\n"
+    "        }\n"
+    "        /* another thread is decompressing the data: wait for it */\n"
+    "    }\n"
+    "}\n"
+    "/* The streaming reader decompresses the data sequentially, in pieces of any\n"
+    "   size, without a buffer for the complete data. Data that was compressed in\n"
+    "   blocks is a sequence of compressed streams, which the reader handles. */\n"
+    "typedef struct bin2c_reader {\n"
+    "    const unsigned char *src;\n"
+    "    size_t srcsize, srcpos;     /* size of the (compressed) data and read position */\n"
+    "    size_t size, pos;           /* size of the decompressed data and read position */\n"
+    "    unsigned int codec;\n"
+    "    int active;                 /* whether a compressed stream is open */\n"
+    "    union {\n"
+    "#if defined BZ_OK\n"
+    "        bz_stream bz2;\n"
+    "#endif\n"
+    "#if defined Z_OK\n"
+    "        z_stream deflate;\n"
+    "#endif\n"
+    "#if defined LZ4F_VERSION\n"
+    "        LZ4F_dctx *lz4;\n"
+    "#endif\n"
+    "#if defined ZSTD_VERSION_NUMBER\n"
+    "        ZSTD_DStream *zstd;\n"
+    "#endif\n"
+    "        int none;\n"
+    "    } ctx;\n"
+    "} bin2c_reader;\n"
+    "/* bin2c_reader_open() returns 0 on failure */\n"
+    "static inline int bin2c_reader_open(bin2c_reader *reader, const void *data, size_t size,\n"
+    "                                    size_t size_uncompressed, unsigned int codec)\n"
+    "{\n"
+    "    memset(reader, 0, sizeof(bin2c_reader));\n"
+    "    reader->src = (const unsigned char *)data;\n"
+    "    reader->srcsize = size;\n"
+    "    reader->size = size_uncompressed;\n"
+    "    reader->codec = codec;\n"
+    "    switch (codec) {\n"
+    "    case BIN2C_CODEC_NONE:\n"
+    "        return 1;\n"
+    "#if defined BZ_OK\n"
+    "    case BIN2C_CODEC_BZ2:\n"
+    "        return 1;\n"
+    "#endif\n"
+    "#if defined Z_OK\n"
+    "    case BIN2C_CODEC_DEFLATE:\n"
+    "        return 1;\n"
+    "#endif\n"
+    "#if defined LZ4F_VERSION\n"
+    "    case BIN2C_CODEC_LZ4:\n"
+    "        return !LZ4F_isError(LZ4F_createDecompressionContext(&reader->ctx.lz4, LZ4F_VERSION));\n"
+    "#endif\n"
+    "#if defined ZSTD_VERSION_NUMBER\n"
+    "    case BIN2C_CODEC_ZSTD:\n"
+    "        reader->ctx.zstd = ZSTD_createDStream();\n"
+    "        return reader->ctx.zstd != 0 && !ZSTD_isError(ZSTD_initDStream(reader->ctx.zstd));\n"
+    "#endif\n"
+    "    }\n"
+    "    return 0;\n"
+    "}\n"
+    "/* bin2c_reader_read() decompresses up to \"count\" bytes into \"buffer\"; it\n"
+    "   returns the number of bytes read (0 at the end of the data), or (size_t)-1\n"
+    "   on an error */\n"
+    "static inline size_t bin2c_reader_read(bin2c_reader *reader, void *buffer, size_t count)\n"
+    "{\n"
+    "    unsigned char *dst = (unsigned char *)buffer;\n"
+    "    size_t total = 0;\n"
+    "    if (count > reader->size - reader->pos)\n"
+    "        count = reader->size - reader->pos;\n"
+    "    if (reader->codec == BIN2C_CODEC_NONE) {\n"
+    "        memcpy(dst, reader->src + reader->pos, count);\n"
+    "        reader->pos += count;\n"
+    "        return count;\n"
+    "    }\n"
+    "    while (total < count) {\n"
+    "        const unsigned char *src = reader->src + reader->srcpos;\n"
+    "        size_t in = reader->srcsize - reader->srcpos, out = count - total;\n"
+    "        int error = 1;\n"
+    "        switch (reader->codec) {\n"
+    "#if defined BZ_OK\n"
+    "        case BIN2C_CODEC_BZ2: {\n"
+    "            int result;\n"
+    "            if (!reader->active && BZ2_bzDecompressInit(&reader->ctx.bz2, 0, 0) != BZ_OK)\n"
+    "                break;\n"
+    "            reader->active = 1;\n"
+    "            reader->ctx.bz2.next_in = (char *)src;\n"
+    "            reader->ctx.bz2.avail_in = (unsigned int)in;\n"
+    "            reader->ctx.bz2.next_out = (char *)dst + total;\n"
+    "            reader->ctx.bz2.avail_out = (unsigned int)out;\n"
+    "            result = BZ2_bzDecompress(&reader->ctx.bz2);\n"
+    "            in -= reader->ctx.bz2.avail_in;\n"
+    "            out -= reader->ctx.bz2.avail_out;\n"
+    "            if (result == BZ_STREAM_END) {\n"
+    "                BZ2_bzDecompressEnd(&reader->ctx.bz2);\n"
+    "                reader->active = 0;\n"
+    "            }\n"
+    "            error = (result != BZ_OK && result != BZ_STREAM_END);\n"
+    "            break;\n"
+    "        }\n"
+    "#endif\n"
+    "#if defined Z_OK\n"
+    "        case BIN2C_CODEC_DEFLATE: {\n"
+    "            int result;\n"
+    "            if (!reader->active && inflateInit(&reader->ctx.deflate) != Z_OK)\n"
+    "                break;\n"
+    "            reader->active = 1;\n"
+    "            reader->ctx.deflate.next_in = (Bytef *)src;\n"
+    "            reader->ctx.deflate.avail_in = (uInt)in;\n"
+    "            reader->ctx.deflate.next_out = (Bytef *)dst + total;\n"
+    "            reader->ctx.deflate.avail_out = (uInt)out;\n"
+    "            result = inflate(&reader->ctx.deflate, Z_NO_FLUSH);\n"
+    "            in -= reader->ctx.deflate.avail_in;\n"
+    "            out -= reader->ctx.deflate.avail_out;\n"
+    "            if (result == Z_STREAM_END) {\n"
+    "                inflateEnd(&reader->ctx.deflate);\n"
+    "                reader->active = 0;\n"
+    "            }\n"
+    "            error = (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR);\n"
+    "            break;\n"
+    "        }\n"
+    "#endif\n"
+    "#if defined LZ4F_VERSION\n"
+    "        case BIN2C_CODEC_LZ4:\n"
+    "            error = LZ4F_isError(LZ4F_decompress(reader->ctx.lz4, dst + total, &out, src, &in, 0));\n"
+    "            break;\n"
+    "#endif\n"
+    "#if defined ZSTD_VERSION_NUMBER\n"
+    "        case BIN2C_CODEC_ZSTD: {\n"
+    "            ZSTD_inBuffer input = { src, in, 0 };\n"
+    "            ZSTD_outBuffer output = { dst + total, out, 0 };\n"
+    "            error = ZSTD_isError(ZSTD_decompressStream(reader->ctx.zstd, &output, &input));\n"
+    "            in = input.pos;\n"
+    "            out = output.pos;\n"
+    "            break;\n"
+    "        }\n"
+    "#endif\n"
+    "        }\n"
+    "        (void)src;      /* in case no codec header is included */\n"
+    "        if (error || (in == 0 && out == 0))\n"
+    "            return (size_t)-1;  /* corrupt or truncated data */\n"
+    "        reader->srcpos += in;\n"
+    "        total += out;\n"
+    "    }\n"
+    "    reader->pos += total;\n"
+    "    return total;\n"
+    "}\n"
+    "static inline void bin2c_reader_close(bin2c_reader *reader)\n"
+    "{\n"
+    "    switch (reader->codec) {\n"
+    "#if defined BZ_OK\n"
+    "    case BIN2C_CODEC_BZ2:\n"
+    "        if (reader->active)\n"
+    "            BZ2_bzDecompressEnd(&reader->ctx.bz2);\n"
+    "        break;\n"
+    "#endif\n"
+    "#if defined Z_OK\n"
+    "    case BIN2C_CODEC_DEFLATE:\n"
+    "        if (reader->active)\n"
+    "            inflateEnd(&reader->ctx.deflate);\n"
+    "        break;\n"
+    "#endif\n"
+    "#if defined LZ4F_VERSION\n"
+    "    case BIN2C_CODEC_LZ4:\n"
+    "        LZ4F_freeDecompressionContext(reader->ctx.lz4);\n"
+    "        break;\n"
+    "#endif\n"
+    "#if defined ZSTD_VERSION_NUMBER\n"
+    "    case BIN2C_CODEC_ZSTD:\n"
+    "        ZSTD_freeDStream(reader->ctx.zstd);\n"
+    "        break;\n"
+    "#endif\n"
+    "    }\n"
+    "    reader->active = 0;\n"
+    "}\n"
+    "#endif\n";
+
+/* A header-only helper for random access to data that was compressed in
+   blocks, through a cache of decompressed blocks (option --accessor with
+   --blocksize); it is emitted once per output file. */
+static const char pager_helper[] =
+    "#ifndef BIN2C_PAGER\n"
+    "#define BIN2C_PAGER\n"
+    "#include <limits.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "/* The pager gives access to data that was compressed in blocks, by offset; it\n"
+    "   decompresses a block when it is first touched, into a cache of a fixed\n"
+    "   number of pages (of one block each), and it evicts the least recently used\n"
+    "   page when the cache is full. A pager must not be used from several threads\n"
+    "   at the same time (use a pager per thread, or a lock). The header file of the\n"
+    "   codec must be included before this file. */\n"
+    "typedef struct bin2c_pager {\n"
+    "    const void *data;\n"
+    "    const unsigned int *index;\n"
+    "    unsigned int block_size, size_uncompressed, codec;\n"
+    "    unsigned int count;         /* number of pages in the cache */\n"
+    "    unsigned char *pages;       /* count * block_size bytes */\n"
+    "    unsigned int *blocks;       /* block held in each page (UINT_MAX for none) */\n"
+    "    unsigned long *stamps;      /* last use of each page */\n"
+    "    unsigned int *map;          /* page that holds each block (UINT_MAX for none) */\n"
+    "    unsigned long clock;\n"
+    "} bin2c_pager;\n"
+    "/* bin2c_pager_open() allocates a cache of \"count\" pages; it returns 0 on\n"
+    "   failure */\n"
+    "static inline int bin2c_pager_open(bin2c_pager *pager, const void *data, const unsigned int *index,\n"
+    "                                   unsigned int block_size, unsigned int size_uncompressed,\n"
+    "                                   unsigned int codec, unsigned int count)\n"
+    "{\n"
+    "    unsigned int nblocks = (size_uncompressed + block_size - 1) / block_size;\n"
+    "    memset(pager, 0, sizeof(bin2c_pager));\n"
+    "    if (count == 0)\n"
+    "        return 0;\n"
+    "    if (count > nblocks)\n"
+    "        count = (nblocks > 0) ? nblocks : 1;\n"
+    "    pager->data = data;\n"
+    "    pager->index = index;\n"
+    "    pager->block_size = block_size;\n"
+    "    pager->size_uncompressed = size_uncompressed;\n"
+    "    pager->codec = codec;\n"
+    "    pager->count = count;\n"
+    "    pager->pages = (unsigned char *)malloc((size_t)count * block_size);\n"
+    "    pager->blocks = (unsigned int *)malloc(count * sizeof(unsigned int));\n"
+    "    pager->stamps = (unsigned long *)calloc(count, sizeof(unsigned long));\n"
+    "    pager->map = (unsigned int *)malloc((nblocks > 0 ? nblocks : 1) * sizeof(unsigned int));\n"
+    "    if (pager->pages == 0 || pager->blocks == 0 || pager->stamps == 0 || pager->map == 0) {\n"
+    "        free(pager->pages);\n"
+    "        free(pager->blocks);\n"
+    "        free(pager->stamps);\n"
+    "        free(pager->map);\n"
+    "        memset(pager, 0, sizeof(bin2c_pager));\n"
+    "        return 0;\n"
+    "    }\n"
+    "    memset(pager->blocks, 0xff, count * sizeof(unsigned int));\n"
+    "    memset(pager->map, 0xff, (nblocks > 0 ? nblocks : 1) * sizeof(unsigned int));\n"
+    "    return 1;\n"
+    "}\n"
+    "static inline void bin2c_pager_close(bin2c_pager *pager)\n"
+    "{\n"
+    "    free(pager->pages);\n"
+    "    free(pager->blocks);\n"
+    "    free(pager->stamps);\n"
+    "    free(pager->map);\n"
+    "    memset(pager, 0, sizeof(bin2c_pager));\n"
+    "}\n"
+    "/* bin2c_pager_get() returns a pointer to the byte at \"offset\" in the\n"
+    "   decompressed data, and sets \"length\" to the number of bytes from \"offset\" up\n"
+    "   to the end of its page; the pointer stays valid until the page is evicted\n"
+    "   (by the access of another block). It returns NULL if the offset is beyond\n"
+    "   the end of the data, or if the block cannot be decompressed. */\n"
+    "static inline const unsigned char *bin2c_pager_get(bin2c_pager *pager, unsigned int offset,\n"
+    "                                                   unsigned int *length)\n"
+    "{\n"
+    "    unsigned int block, page, size;\n"
+    "    if (offset >= pager->size_uncompressed || pager->count == 0)\n"
+    "        return 0;\n"
+    "    block = offset / pager->block_size;\n"
+    "    size = pager->size_uncompressed - block * pager->block_size;\n"
+    "    if (size > pager->block_size)\n"
+    "        size = pager->block_size;\n"
+    "    page = pager->map[block];\n"
+    "    if (page == UINT_MAX) {\n"
+    "        /* take an empty page, or else the least recently used one */\n"
+    "        unsigned int idx;\n"
+    "        page = 0;\n"
+    "        for (idx = 0; idx < pager->count && pager->blocks[page] != UINT_MAX; idx++)\n"
+    "            if (pager->blocks[idx] == UINT_MAX || pager->stamps[idx] < pager->stamps[page])\n"
+    "                page = idx;\n"
+    "        if (pager->blocks[page] != UINT_MAX)\n"
+    "            pager->map[pager->blocks[page]] = UINT_MAX;\n"
+    "        pager->blocks[page] = UINT_MAX;\n"
+    "        if (bin2c_decompress(pager->pages + (size_t)page * pager->block_size, size,\n"
+    "                             (const char *)pager->data + pager->index[block],\n"
+    "                             pager->index[block + 1] - pager->index[block], pager->codec) != size)\n"
+    "            return 0;\n"
+    "        pager->blocks[page] = block;\n"
+    "        pager->map[block] = page;\n"
+    "    }\n"
+    "    pager->stamps[page] = ++pager->clock;\n"
+    "    if (length != 0)\n"
+    "        *length = size - (offset - block * pager->block_size);\n"
+    "    return pager->pages + (size_t)page * pager->block_size + (offset - block * pager->block_size);\n"
+    "}\n"
+    "/* bin2c_pager_read() copies up to \"count\" bytes from \"offset\" into \"buffer\";\n"
+    "   it returns the number of bytes copied (which is less than \"count\" at the end\n"
+    "   of the data), or (size_t)-1 on an error */\n"
+    "static inline size_t bin2c_pager_read(bin2c_pager *pager, void *buffer, unsigned int offset, size_t count)\n"
+    "{\n"
+    "    size_t total = 0;\n"
+    "    if (offset >= pager->size_uncompressed)\n"
+    "        return 0;\n"
+    "    if (count > pager->size_uncompressed - offset)\n"
+    "        count = pager->size_uncompressed - offset;\n"
+    "    while (total < count) {\n"
+    "        unsigned int length;\n"
+    "        const unsigned char *src = bin2c_pager_get(pager, offset + (unsigned int)total, &length);\n"
+    "        if (src == 0)\n"
+    "            return (size_t)-1;\n"
+    "        if (length > count - total)\n"
+    "            length = (unsigned int)(count - total);\n"
+    "        memcpy((unsigned char *)buffer + total, src, length);\n"
+    "        total += length;\n"
+    "    }\n"
+    "    return total;\n"
+    "}\n"
+    "#endif\n";
+
+/* A header-only helper for applying a patch against a base file (option
+   --base); it is emitted once per output file. */
+static const char patch_helper[] =
+    "#ifndef BIN2C_PATCH\n"
+    "#define BIN2C_PATCH\n"
+    "#include <stddef.h>\n"
+    "#include <string.h>\n"
+    "/* bin2c_patch_number() decodes a variable-length number from the patch */\n"
+    "static inline size_t bin2c_patch_number(const unsigned char **ptr, const unsigned char *end, int *error)\n"
+    "{\n"
+    "    size_t value = 0;\n"
+    "    unsigned int shift = 0;\n"
+    "    while (*ptr < end && shift < 8 * sizeof(size_t)) {\n"
+    "        unsigned char c = *(*ptr)++;\n"
+    "        value |= (size_t)(c & 0x7f) << shift;\n"
+    "        if ((c & 0x80) == 0)\n"
+    "            return value;\n"
+    "        shift += 7;\n"
+    "    }\n"
+    "    *error = 1;\n"
+    "    return 0;\n"
+    "}\n"
+    "/* bin2c_patch() rebuilds the data from the base and the patch, into \"buffer\"\n"
+    "   (which must be \"size\" bytes, at least the size of the result); it returns\n"
+    "   the size of the result, or 0 on failure. The buffer may be the base itself,\n"
+    "   if the patch allows it (and if the buffer is large enough for the result). */\n"
+    "static inline size_t bin2c_patch(void *buffer, size_t size, const void *base, size_t base_size,\n"
+    "                                 const void *patch, size_t patch_size)\n"
+    "{\n"
+    "    const unsigned char *ptr = (const unsigned char *)patch;\n"
+    "    const unsigned char *end = ptr + patch_size;\n"
+    "    unsigned char *dst = (unsigned char *)buffer;\n"
+    "    const unsigned char *src = (const unsigned char *)base;\n"
+    "    size_t result, pos;\n"
+    "    int error = 0;\n"
+    "    result = bin2c_patch_number(&ptr, end, &error);\n"
+    "    if (bin2c_patch_number(&ptr, end, &error) != base_size || error || ptr >= end || result > size)\n"
+    "        return 0;\n"
+    "    if ((const unsigned char *)dst == src && (*ptr & 0x01) == 0)\n"
+    "        return 0;           /* this patch cannot be applied in place */\n"
+    "    ptr++;\n"
+    "    for (pos = 0; pos < result; ) {\n"
+    "        size_t op = bin2c_patch_number(&ptr, end, &error);\n"
+    "        size_t length = op >> 1;\n"
+    "        if (error || length > result - pos)\n"
+    "            return 0;\n"
+    "        if (op & 1) {\n"
+    "            if (length > (size_t)(end - ptr))\n"
+    "                return 0;\n"
+    "            memcpy(dst + pos, ptr, length);\n"
+    "            ptr += length;\n"
+    "        } else {\n"
+    "            size_t distance = bin2c_patch_number(&ptr, end, &error);\n"
+    "            size_t source = pos + ((distance >> 1) ^ (0 - (distance & 1)));   /* zigzag decoding */\n"
+    "            if (error || source > base_size || length > base_size - source)\n"
+    "                return 0;\n"
+    "            if (dst + pos != src + source)\n"
+    "                memmove(dst + pos, src + source, length);\n"
+    "        }\n"
+    "        pos += length;\n"
+    "    }\n"
+    "    return result;\n"
+    "}\n"
+    "#endif\n";
+
+/* replace_extension() returns a newly allocated copy of "path" where the
+   extension of the filename is replaced by "ext" (which includes the '.') */
+static char *replace_extension(const char *path, const char *ext)
+{
+    char *name = malloc(strlen(path) + strlen(ext) + 1);
+    if (name == NULL)
+        fatal("Memory allocation error.");
+    strcpy(name, path);
+    char *dot = strrchr(name, '.');
+    if (dot != NULL && strpbrk(dot, "\\/") == NULL)
+        *dot = '\0';
+    strcat(name, ext);
+    return name;
+}
+
+/* data_filename() returns a newly allocated filename for storing data of a
+   symbol (the transformed data in a ".blob" file, or a shard of the array in
+   a ".c" file), in the same directory as the output file */
+static char *data_filename(const char *outputname, const char *symbolname, const char *suffix)
+{
+    const char *base = outputname;
+    while (strpbrk(base, "\\/") != NULL)
+        base = strpbrk(base, "\\/") + 1;
+    size_t dirlen = base - outputname;
+    char *name = malloc(dirlen + strlen(symbolname) + strlen(suffix) + 1);
+    if (name == NULL)
+        fatal("Memory allocation error.");
+    memcpy(name, outputname, dirlen);
+    strcpy(name + dirlen, symbolname);
+    strcat(name, suffix);
+    return name;
+}
+
+/* full_path() returns a newly allocated absolute path for the (existing) file,
+   with forward slashes as directory separators, for use in the generated files
+   (on other systems than Windows, a backslash is a valid character in a
+   filename, and it is kept) */
+static char *full_path(const char *path)
+{
+#if defined _WIN32
+    char *name = _fullpath(NULL, path, 0);
+#else
+    char *name = realpath(path, NULL);
+#endif
+    if (name == NULL)
+        name = strdup(path);
+    if (name == NULL)
+        fatal("Memory allocation error.");
+#if defined _WIN32
+    for (char *ptr = name; *ptr != '\0'; ptr++)
+        if (*ptr == '\\')
+            *ptr = '/';
+#endif
+    return name;
+}
+
+/* Options that apply to a single conversion; in batch mode, the entries in a
+   list file may override the options given on the command line. */
+typedef struct tagOPTIONS {
+    const char *label;          /* template for the symbol name (NULL for default) */
+    const char *outputname;     /* output file (NULL for default) */
+    const char *section;        /* linker section for the array (NULL for default) */
+    const char *base;           /* file for delta encoding (NULL for none) */
+    const char *cpp_namespace;  /* C++ namespace for the declarations (NULL for none) */
+    unsigned int align;         /* alignment of the array (0 for default) */
+    int format;
+    unsigned int bitsize;
+    unsigned int jobs;
+    int codec;
+    int level;
+    bool level_set;             /* whether a compression level was given */
+    size_t block_size;          /* 0 for compressing the data as a whole */
+    uint64_t split_size;        /* maximum size of a sub-array (0 for a single array) */
+    unsigned int shards;        /* number of .c files for the sub-arrays (0 for none) */
+    bool is_textfile;
+    bool is_mutable;
+    bool use_macro;
+    bool zero_terminate;
+    bool big_endian;            /* byte order of multi-byte elements */
+    bool accessor;              /* emit the accessor functions for the symbol */
+    bool sparse;                /* designated initializers for runs of equal elements */
+    bool cpp;                   /* C++17 "inline constexpr" declarations */
+} OPTIONS;
+
+static void init_options(OPTIONS *opts)
+{
+    memset(opts, 0, sizeof(OPTIONS));
+    opts->format = FORMAT_ARRAY;
+    opts->bitsize = 8;
+    opts->jobs = 1;
+    opts->codec = DEFAULT_CODEC;
+}
+
+/* parse_size() parses a size with an optional suffix 'k', 'M' or 'G' (for
+   kilobytes, megabytes or gigabytes); it returns 0 on an invalid value */
+static uint64_t parse_size(const char *value)
+{
+    char *end;
+    uint64_t size = strtoull(value, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+        size <<= 10;
+        end++;
+    } else if (*end == 'M') {
+        size <<= 20;
+        end++;
+    } else if (*end == 'G') {
+        size <<= 30;
+        end++;
+    }
+    return (*end == '\0' && end != value && isdigit((unsigned char)value[0])) ? size : 0;
+}
+
+/* option_value() returns the value of an option that takes a parameter, which
+   may either directly follow the option name or be in the next argument */
+static const char *option_value(int argc, char *argv[], int *idx, unsigned int namelength)
+{
+    if (argv[*idx][namelength] != '\0')
+        return &argv[*idx][namelength];
+    if ((*idx + 1) < argc)
+        return argv[++*idx];
+    about(argv[*idx]); /* invalid option */
+    return NULL;
+}
+
+/* parse_option() handles the option at argv[*idx], plus its parameter; it
+   advances *idx past the parameter and returns false for unknown options */
+static bool parse_option(OPTIONS *opts, int argc, char *argv[], int *idx)
+{
+    const char *arg = argv[*idx];
+    assert(arg[0] == '-');
+    if (strcmp(arg, "--accessor") == 0) {
+        opts->accessor = true;
+    } else if (strncmp(arg, "--align", 7) == 0) {
+        const char *value = option_value(argc, argv, idx, 7);
+        char *end;
+        unsigned long align = strtoul(value, &end, 10);
+        if (*end != '\0' || align == 0 || (align & (align - 1)) != 0 || align > 65536)
+            fatal("Invalid alignment '%s' (must be a power of 2, up to 65536).", value);
+        opts->align = (unsigned int)align;
+    } else if (strncmp(arg, "--base", 6) == 0) {
+        opts->base = option_value(argc, argv, idx, 6);
+    } else if (strncmp(arg, "-b", 2) == 0 || strncmp(arg, "--bits", 6) == 0) {
+        unsigned int j = (arg[1] == '-') ? 6 : 2;
+        if (isdigit(arg[j]))
+            opts->bitsize = atoi(&arg[j]);
+        else if (arg[j] == '\0' && (*idx + 1) < argc)
+            opts->bitsize = atoi(argv[++*idx]);
+        else
+            about(arg); /* invalid option */
+        if (opts->bitsize != 8 && opts->bitsize != 16 && opts->bitsize != 32 && opts->bitsize != 64)
+            fatal("Invalid bit size (must be 8, 16, 32 or 64).");
+    } else if (strncmp(arg, "--blocksize", 11) == 0) {
+        const char *value = option_value(argc, argv, idx, 11);
+        uint64_t size = parse_size(value);
+        if (size == 0 || size > UINT_MAX)
+            fatal("Invalid block size '%s'.", value);
+        opts->block_size = (size_t)size;
+    } else if (strncmp(arg, "-c", 2) == 0 || strncmp(arg, "--compress", 10) == 0) {
+        const char *name = option_value(argc, argv, idx, (arg[1] == '-') ? 10 : 2);
+        int codec = 0;
+        while (codec < CODEC_COUNT && strcmp(codecs[codec].name, name) != 0)
+            codec++;
+        if (codec == CODEC_COUNT)
+            fatal("Invalid compression codec '%s'.", name);
+        if (codec != CODEC_NONE && codecs[codec].init == NULL)
+            fatal("Compression codec '%s' is not supported in this build.", name);
+        opts->codec = codec;
+    } else if (strcmp(arg, "--cpp") == 0) {
+        opts->cpp = true;
+    } else if (strcmp(arg, "-d") == 0 || strcmp(arg, "--define") == 0) {
+        opts->use_macro = true;
+    } else if (strncmp(arg, "--endian", 8) == 0) {
+        const char *value = option_value(argc, argv, idx, 8);
+        if (strcmp(value, "little") == 0)
+            opts->big_endian = false;
+        else if (strcmp(value, "big") == 0)
+            opts->big_endian = true;
+        else
+            fatal("Invalid byte order '%s' (must be 'little' or 'big').", value);
+    } else if (strncmp(arg, "-f", 2) == 0 || strncmp(arg, "--format", 8) == 0) {
+        const char *name = option_value(argc, argv, idx, (arg[1] == '-') ? 8 : 2);
+        if (strcmp(name, "array") == 0)
+            opts->format = FORMAT_ARRAY;
+        else if (strcmp(name, "incbin") == 0)
+            opts->format = FORMAT_INCBIN;
+        else if (strcmp(name, "embed") == 0)
+            opts->format = FORMAT_EMBED;
+        else if (strcmp(name, "string") == 0)
+            opts->format = FORMAT_STRING;
+        else
+            fatal("Invalid format '%s'.", name);
+    } else if (strncmp(arg, "-j", 2) == 0 || strncmp(arg, "--jobs", 6) == 0) {
+        unsigned int j = (arg[1] == '-') ? 6 : 2;
+        if (isdigit(arg[j]))
+            opts->jobs = atoi(&arg[j]);
+        else if (arg[j] == '\0' && (*idx + 1) < argc)
+            opts->jobs = atoi(argv[++*idx]);
+        else
+            about(arg); /* invalid option */
+        if (opts->jobs == 0)
+            opts->jobs = cpu_count();
+        if (opts->jobs > MAX_JOBS)
+            opts->jobs = MAX_JOBS;
+    } else if (strncmp(arg, "--level", 7) == 0) {
+        const char *value = option_value(argc, argv, idx, 7);
+        char *end;
+        opts->level = (int)strtol(value, &end, 10);
+        if (*end != '\0')
+            fatal("Invalid compression level '%s'.", value);
+        opts->level_set = true;
+    } else if (strncmp(arg, "-l", 2) == 0 || strncmp(arg, "--label", 7) == 0) {
+        opts->label = option_value(argc, argv, idx, (arg[1] == '-') ? 7 : 2);
+    } else if (strcmp(arg, "-m") == 0 || strcmp(arg, "--mutable") == 0) {
+        opts->is_mutable = true;
+    } else if (strncmp(arg, "--namespace", 11) == 0) {
+        opts->cpp_namespace = option_value(argc, argv, idx, 11);
+        opts->cpp = true;
+    } else if (strncmp(arg, "-o", 2) == 0 || strncmp(arg, "--output", 8) == 0) {
+        opts->outputname = option_value(argc, argv, idx, (arg[1] == '-') ? 8 : 2);
+    } else if (strncmp(arg, "--section", 9) == 0) {
+        opts->section = option_value(argc, argv, idx, 9);
+    } else if (strncmp(arg, "--shards", 8) == 0) {
+        const char *value = option_value(argc, argv, idx, 8);
+        char *end;
+        unsigned long shards = strtoul(value, &end, 10);
+        if (*end != '\0' || shards == 0 || shards > 10000)
+            fatal("Invalid number of shards '%s' (must be 1..10000).", value);
+        opts->shards = (unsigned int)shards;
+    } else if (strcmp(arg, "--sparse") == 0) {
+        opts->sparse = true;
+    } else if (strncmp(arg, "--split", 7) == 0) {
+        const char *value = option_value(argc, argv, idx, 7);
+        opts->split_size = parse_size(value);
+        if (opts->split_size == 0)
+            fatal("Invalid split size '%s'.", value);
+    } else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--text") == 0) {
+        opts->is_textfile = true;
+    } else if (strcmp(arg, "-z") == 0 || strcmp(arg, "--zero") == 0) {
+        opts->zero_terminate = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* An entry is a single input file with its options; "storage" (if set) holds
+   the strings that the entry refers to */
+typedef struct tagENTRY {
+    const char *inputname;
+    OPTIONS opts;
+    char *storage;
+} ENTRY;
+
+typedef struct tagENTRYLIST {
+    ENTRY *entries;
+    unsigned int count;
+    unsigned int size;
+} ENTRYLIST;
+
+static ENTRY *add_entry(ENTRYLIST *list, const char *inputname, const OPTIONS *opts)
+{
+    if (list->count == list->size) {
+        list->size = (list->size == 0) ? 16 : 2 * list->size;
+        list->entries = realloc(list->entries, list->size * sizeof(ENTRY));
+        if (list->entries == NULL)
+            fatal("Memory allocation error.");
+    }
+    ENTRY *entry = &list->entries[list->count++];
+    entry->inputname = inputname;
+    entry->opts = *opts;
+    entry->storage = NULL;
+    return entry;
+}
+
+static void free_entries(ENTRYLIST *list)
+{
+    for (unsigned int idx = 0; idx < list->count; idx++)
+        free(list->entries[idx].storage);
+    free(list->entries);
+    list->entries = NULL;
+    list->count = list->size = 0;
+}
+
+/* read_listfile() adds an entry for every line in the list file; each line
+   holds an input filename, optionally followed by options (these override the
+   options on the command line); names with spaces must be quoted, and empty
+   lines and lines starting with a '#' are ignored */
+static void read_listfile(ENTRYLIST *list, const char *listname, const OPTIONS *defaults)
+{
+    FILE *fp = fopen(listname, "rt");
+    if (fp == NULL)
+        fatal("Failed to open %s for reading.", listname);
+    char line[_MAX_PATH * 4];
+    unsigned int linenr = 0;
+    while (fgets(line, sizeof line, fp) != NULL) {
+        linenr++;
+        char *storage = strdup(line);
+        if (storage == NULL)
+            fatal("Memory allocation error.");
+        /* split the line into arguments (in place) */
+        char *args[64];
+        int count = 0;
+        char *ptr = storage;
+        for ( ;; ) {
+            while (*ptr != '\0' && isspace((unsigned char)*ptr))
+                ptr++;
+            if (*ptr == '\0' || (count == 0 && *ptr == '#'))
+                break;
+            if (count >= (int)(sizeof args / sizeof args[0]))
+                fatal("Too many options in %s, line %u.", listname, linenr);
+            if (*ptr == '"') {
+                args[count++] = ++ptr;
+                while (*ptr != '\0' && *ptr != '"')
+                    ptr++;
+            } else {
+                args[count++] = ptr;
+                while (*ptr != '\0' && !isspace((unsigned char)*ptr))
+                    ptr++;
+            }
+            if (*ptr != '\0')
+                *ptr++ = '\0';
+        }
+        if (count == 0) {
+            free(storage);
+            continue;
+        }
+        if (args[0][0] == '-')
+            fatal("Missing input file in %s, line %u.", listname, linenr);
+        ENTRY *entry = add_entry(list, args[0], defaults);
+        entry->storage = storage;
+        for (int idx = 1; idx < count; idx++)
+            if (args[idx][0] != '-' || !parse_option(&entry->opts, count, args, &idx))
+                fatal("Invalid option '%s' in %s, line %u.", args[idx], listname, linenr);
+    }
+    fclose(fp);
+}
+
+/* default_outputname() returns a newly allocated name for the output file, which
+   is the name of the input file with the extension ".h" */
+static char *default_outputname(const char *inputname)
+{
+    char *ext;
+    char *outputname = malloc(strlen(inputname) + 3); /* +2 for ".h" extension, +1 for '\0' */
+    if (outputname == NULL)
+        fatal("Memory allocation error.");
+    strcpy(outputname, inputname);
+    ext = strrchr(outputname, '.');
+    if (ext != NULL && strpbrk(outputname, "\\/") == NULL)
+        *ext = '\0';    /* remove old extension */
+    strcat(outputname, ".h");
+    return outputname;
+}
+
+/* make_symbolname() returns a newly allocated symbol name from the label
+   template, where '$*' is replaced by the base name of the input file and '$@'
+   by the full name (without path); invalid characters are replaced by '_' */
+static char *make_symbolname(const char *label, const char *inputname)
+{
+    /* prepare names for the automatic label */
+    const char *fpos = inputname;
+    while (strpbrk(fpos, "\\/") != NULL)
+        fpos = strpbrk(fpos, "\\/") + 1;    /* skip all directory names */
+    char *fullname = malloc(strlen(fpos) + 1);  /* +1 for '\0' */
+    if (fullname == NULL)
+        fatal("Memory allocation error.");
+    strcpy(fullname, fpos);
+    char *basename = strdup(fullname);
+    if (basename == NULL)
+        fatal("Memory allocation error.");
+    char *ext = strrchr(basename, '.');
+    if (ext != NULL)
+        *ext = '\0';    /* remove extension from base name */
+    fpos = label;
+    if (fpos == NULL)
+        fpos = "$*";
+    size_t symlen = strlen(fpos);
+    if (strstr(fpos, "$*") != NULL)
+        symlen += strlen(basename);
+    if (strstr(fpos, "$@") != NULL)
+        symlen += strlen(fullname);
+    char *symbolname = malloc(symlen + 1);  /* +1 for '\0' */
+    if (symbolname == NULL)
+        fatal("Memory allocation error.");
+    *symbolname = '\0';
+    while (*fpos != '\0') {
+        if (strncmp(fpos, "$*", 2) == 0) {
+            strcat(symbolname, basename);
+            fpos += 2;
+        } else if (strncmp(fpos, "$@", 2) == 0) {
+            strcat(symbolname, fullname);
+            fpos += 2;
+        } else {
+            size_t len = strlen(symbolname);
+            symbolname[len] = *fpos;
+            symbolname[len+1] = '\0';
+            fpos += 1;
+        }
+    }
+    free(fullname);
+    free(basename);
+    char *ptr = symbolname;
+    if (!isalpha(*ptr) && *ptr != '_')
+        *ptr = '_';
+    while (*ptr != '\0') {
+        if (!isalnum(*ptr) && *ptr != '_')
+            *ptr = '_';
+        ptr++;
+    }
+    return symbolname;
+}
+
+/* hash_file() adds the contents of the file to the hash */
+static void hash_file(HASH *hash, const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+        fatal("Failed to open %s for reading.", filename);
+    INPUT input;
+    input_init(&input, fp, true, INPUT_BLOCK);
+    const uint8_t *data;
+    size_t size;
+    while ((size = input_read(&input, &data, INPUT_BLOCK)) > 0)
+        hash_update(hash, data, size);
+    input_close(&input);
+}
+
+/* output_data_hash() notes the hash of the contents of the data file of a
+   symbol (for --update), after the directive that includes the file */
+static void output_data_hash(OUTPUT *out, const char *symbolname, const uint64_t *hash)
+{
+    if (hash != NULL)
+        output_printf(out, " /* data of %s, hash %016" PRIx64 " */", symbolname, *hash);
+}
+
+/* output_asmstring() writes the text as a string for the assembler (in the
+   syntax of the GNU assembler, which is close to that of C) */
+static void output_asmstring(OUTPUT *out, const char *text)
+{
+    output_printf(out, "\"");
+    for ( ; *text != '\0'; text++) {
+        unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\')
+            output_printf(out, "\\%c", c);
+        else if (c < ' ' || c >= 0x7f)
+            output_printf(out, "\\%03o", c);
+        else
+            output_printf(out, "%c", c);
+    }
+    output_printf(out, "\"");
+}
+
+/* write_incbin() writes (or appends) an assembler file that includes the data
+   file "dataname" with the .incbin directive, followed by "padding" zero bytes;
+   the assembler file is run through the C preprocessor (extension .S), for
+   selecting the section and symbol name conventions for the target; the
+   "index" array with "index_count" block offsets is optional, and so is the
+   hash of a data file that Bin2C wrote */
+static void write_incbin(const char *asmname, bool is_appending, const char *dataname,
+                         const uint64_t *data_hash, const char *symbolname, const OPTIONS *opts,
+                         unsigned int padding, uint64_t array_size, const uint32_t *index,
+                         unsigned int index_count)
+{
+    OUTPUT out;
+    output_init(&out, NULL);
+    output_open(&out, asmname, is_appending);
+    if (!is_appending) {
+        output_banner(&out);
+        output_printf(&out, "#if defined __APPLE__ || (defined _WIN32 && !defined _WIN64)\n"
+                            "#   define BIN2C_SYMBOL(name)  _##name\n"
+                            "#else\n"
+                            "#   define BIN2C_SYMBOL(name)  name\n"
+                            "#endif\n"
+                            "#if defined __ELF__\n"
+                            "    .section .note.GNU-stack,\"\",%%progbits\n"
+                            "#endif\n");
+    }
+    output_printf(&out, "\n");
+    if (opts->section != NULL)
+        output_printf(&out, "#if defined _WIN32 || defined __CYGWIN__\n"
+                            "    .section %s,\"%s\"\n"
+                            "#elif defined __APPLE__\n"
+                            "    .section %s\n"
+                            "#else\n"
+                            "    .section %s,\"%s\"\n"
+                            "#endif\n", opts->section, opts->is_mutable ? "dw" : "dr", opts->section,
+                      opts->section, opts->is_mutable ? "aw" : "a");
+    else if (opts->is_mutable)
+        output_printf(&out, "    .data\n");
+    else
+        output_printf(&out, "#if defined __APPLE__\n"
+                            "    .const_data\n"
+                            "#elif defined _WIN32 || defined __CYGWIN__\n"
+                            "    .section .rdata,\"dr\"\n"
+                            "#else\n"
+                            "    .section .rodata\n"
+                            "#endif\n");
+    output_printf(&out, "    .globl BIN2C_SYMBOL(%s)\n"
+                        "    .balign %u\n"
+                        "BIN2C_SYMBOL(%s):\n"
+                        "    .incbin ",
+                  symbolname, (opts->align > (opts->bitsize >> 3)) ? opts->align : (opts->bitsize >> 3),
+                  symbolname);
+    output_asmstring(&out, dataname);
+    output_data_hash(&out, symbolname, data_hash);
+    output_printf(&out, "\n");
+    if (padding > 0)
+        output_printf(&out, "    .zero %u\n", padding);
+    output_printf(&out, "#if defined __ELF__\n"
+                        "    .type %s, %%object\n"
+                        "    .size %s, . - %s\n"
+                        "#endif\n", symbolname, symbolname, symbolname);
+    if (!opts->use_macro && array_size > UINT32_MAX)
+        output_printf(&out, "    .globl BIN2C_SYMBOL(%s_size)\n"
+                            "    .balign 8\n"
+                            "BIN2C_SYMBOL(%s_size):\n"
+                            "    .quad %" PRIu64 "\n", symbolname, symbolname, array_size);
+    else if (!opts->use_macro)
+        output_printf(&out, "    .globl BIN2C_SYMBOL(%s_size)\n"
+                            "    .balign 4\n"
+                            "BIN2C_SYMBOL(%s_size):\n"
+                            "    .long %" PRIu64 "\n", symbolname, symbolname, array_size);
+    if (index != NULL) {
+        output_printf(&out, "    .globl BIN2C_SYMBOL(%s_index)\n"
+                            "    .balign 4\n"
+                            "BIN2C_SYMBOL(%s_index):", symbolname, symbolname);
+        for (unsigned int idx = 0; idx < index_count; idx++)
+            output_printf(&out, "%s%" PRIu32, (idx % 8 == 0) ? "\n    .long " : ", ", index[idx]);
+        output_printf(&out, "\n");
+    }
+    output_done(&out);
+    output_close(&out);
+}
+
+/* output_cstring() writes the text as a C string literal */
+static void output_cstring(OUTPUT *out, const char *text)
+{
+    output_printf(out, "\"");
+    for ( ; *text != '\0'; text++) {
+        unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\' || c == '?')
+            output_printf(out, "\\%c", c);
+        else if (c < ' ' || c >= 0x7f)
+            output_printf(out, "\\%03o", c);
+        else
+            output_printf(out, "%c", c);
+    }
+    output_printf(out, "\"");
+}
+
+/* const_qualifier() returns the qualifier for constant data: in C++ mode, an
+   inline variable has a single instance in the program, even when the header
+   is included in several translation units */
+static const char *const_qualifier(const OPTIONS *opts)
+{
+    return opts->cpp ? "inline constexpr " : "const ";
+}
+
+/* uses_blob() returns whether the data for the incbin and embed formats is
+   stored in a separate data file (".blob"): the input file can be included as
+   is, unless the data is transformed (compressed, read in text mode, or stored
+   as a patch) */
+static bool uses_blob(const OPTIONS *opts)
+{
+    return (opts->format == FORMAT_INCBIN || opts->format == FORMAT_EMBED)
+           && (opts->codec != CODEC_NONE || opts->is_textfile || opts->base != NULL);
+}
+
+/* uses_std_array() returns whether the data is declared as a std::array, which
+   is done in C++ mode for uncompressed arrays (an std::array needs the size in
+   its declaration, before the data) */
+static bool uses_std_array(const OPTIONS *opts)
+{
+    return opts->cpp && opts->format == FORMAT_ARRAY && opts->codec == CODEC_NONE;
+}
+
+/* output_namespace() opens or closes the C++ namespace of the declarations;
+   the first time, it also writes the includes for C++ mode */
+static void output_namespace(OUTPUT *output, const OPTIONS *opts, bool open)
+{
+    if (open && opts->cpp && (output->emitted & EMITTED_CPP) == 0) {
+        output_printf(output, "#ifndef BIN2C_CPP\n"
+                              "#define BIN2C_CPP\n"
+                              "#include <array>\n"
+                              "#if __cplusplus >= 202002L || (defined _MSVC_LANG && _MSVC_LANG >= 202002L)\n"
+                              "#   include <span>\n"
+                              "#   define BIN2C_SPAN\n"
+                              "#endif\n"
+                              "#endif\n");
+        output->emitted |= EMITTED_CPP;
+    }
+    if (opts->cpp_namespace == NULL)
+        return;
+    if (open)
+        output_printf(output, "namespace %s {\n", opts->cpp_namespace);
+    else
+        output_printf(output, "} /* namespace %s */\n", opts->cpp_namespace);
+}
+
+/* output_declspec() starts the declaration of an array with the attributes for
+   alignment and section placement (if set); the macros for these attributes
+   are defined once per output file */
+static void output_declspec(OUTPUT *output, const OPTIONS *opts)
+{
+    if ((opts->align > 0 || opts->section != NULL) && (output->emitted & EMITTED_ATTRIBUTES) == 0) {
+        output_printf(output, "#ifndef BIN2C_ALIGN\n"
+                              "#   if defined __cplusplus && __cplusplus >= 201103L\n"
+                              "#       define BIN2C_ALIGN(n)   alignas(n)\n"
+                              "#   elif defined __STDC_VERSION__ && __STDC_VERSION__ >= 201112L\n"
+                              "#       define BIN2C_ALIGN(n)   _Alignas(n)\n"
+                              "#   elif defined _MSC_VER\n"
+                              "#       define BIN2C_ALIGN(n)   __declspec(align(n))\n"
+                              "#   else\n"
+                              "#       define BIN2C_ALIGN(n)   __attribute__((aligned(n)))\n"
+                              "#   endif\n"
+                              "#endif\n"
+                              "#ifndef BIN2C_SECTION\n"
+                              "#   if defined _MSC_VER\n"
+                              "#       define BIN2C_SECTION(name) __declspec(allocate(name))\n"
+                              "#   else\n"
+                              "#       define BIN2C_SECTION(name) __attribute__((section(name)))\n"
+                              "#   endif\n"
+                              "#endif\n");
+        output->emitted |= EMITTED_ATTRIBUTES;
+    }
+    if (opts->section != NULL) {
+        /* Visual C/C++ requires that the section is declared first */
+        output_printf(output, "#if defined _MSC_VER\n#pragma section(");
+        output_cstring(output, opts->section);
+        output_printf(output, ", read%s)\n#endif\n", opts->is_mutable ? ", write" : "");
+        output_printf(output, "BIN2C_SECTION(");
+        output_cstring(output, opts->section);
+        output_printf(output, ") ");
+    }
+    if (opts->align > 0)
+        output_printf(output, "BIN2C_ALIGN(%u) ", opts->align);
+    if (!opts->is_mutable)
+        output_printf(output, "%s", const_qualifier(opts));
+    else if (opts->cpp)
+        output_printf(output, "inline ");
+}
+
+/* file_length() returns the size of an open file in 64 bits (ftell() returns a
+   long, which is only 32-bit on Windows) */
+static uint64_t file_length(FILE *fp)
+{
+#if defined _WIN32
+    __int64 size = _filelengthi64(_fileno(fp));
+    return (size > 0) ? (uint64_t)size : 0;
+#elif defined __unix__ || defined __APPLE__
+    struct stat st;
+    return (fstat(fileno(fp), &st) == 0 && st.st_size > 0) ? (uint64_t)st.st_size : 0;
+#else
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    return (size > 0) ? (uint64_t)size : 0;
+#endif
+}
+
+/* regular_file() returns whether an open file is a regular file (and not a
+   pipe or a device, for which the size is unknown) */
+static bool regular_file(FILE *fp)
+{
+#if defined _WIN32
+    return GetFileType((HANDLE)_get_osfhandle(_fileno(fp))) == FILE_TYPE_DISK;
+#elif defined __unix__ || defined __APPLE__
+    struct stat st;
+    return fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode);
+#else
+    return true;
+#endif
+}
+
+/* Delta encoding (option --base): the data is stored as a patch that rebuilds
+   the input file from a base file. The patch starts with the size of the
+   result, the size of the base and a flags byte; it is followed by operations,
+   which each start with a number holding the length (shifted left by 1) and
+   the type of the operation (in the lowest bit): 0 for a copy from the base, 1
+   for a literal. A copy is followed by the distance between its position in
+   the base and its position in the result, and a literal by its bytes. Numbers
+   have 7 bits per byte (least significant first, the high bit is set on all but
+   the last byte); the distance is signed, in zigzag encoding. If no copy has
+   its source before its destination, the patch can be applied over the base
+   (no copy then reads data that was already overwritten). */
+#define DELTA_WINDOW    16      /* bytes per hashed position in the base */
+#define DELTA_MIN_MATCH 8       /* minimum length of a copy at the expected position */
+#define DELTA_INPLACE   0x01    /* flag: the patch can be applied in place */
+
+typedef struct tagPATCH {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} PATCH;
+
+static uint8_t *patch_reserve(PATCH *patch, size_t count)
+{
+    if (patch->size + count > patch->capacity) {
+        size_t capacity = (patch->capacity > 0) ? patch->capacity : 4096;
+        while (capacity < patch->size + count)
+            capacity *= 2;
+        uint8_t *data = realloc(patch->data, capacity);
+        if (data == NULL)
+            fatal("Memory allocation error.");
+        patch->data = data;
+        patch->capacity = capacity;
+    }
+    uint8_t *ptr = patch->data + patch->size;
+    patch->size += count;
+    return ptr;
+}
+
+static void patch_number(PATCH *patch, uint64_t value)
+{
+    while (value >= 0x80) {
+        *patch_reserve(patch, 1) = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *patch_reserve(patch, 1) = (uint8_t)value;
+}
+
+static void patch_literal(PATCH *patch, const uint8_t *data, size_t length)
+{
+    if (length > 0) {
+        patch_number(patch, ((uint64_t)length << 1) | 1);
+        memcpy(patch_reserve(patch, length), data, length);
+    }
+}
+
+static size_t match_length(const uint8_t *data1, const uint8_t *data2, size_t limit)
+{
+    size_t length = 0;
+    while (length < limit && data1[length] == data2[length])
+        length++;
+    return length;
+}
+
+static size_t delta_hash(const uint8_t *data, unsigned int bits)
+{
+    uint64_t value = hash_read64(data) * HASH_P1 ^ hash_read64(data + 8) * HASH_P2;
+    return (size_t)(value >> (64 - bits));
+}
+
+/* make_patch() creates the patch that rebuilds "target" from "base"; a match is
+   first tried at the position that follows the previous copy (for data that
+   is changed in place), and else through a hash table of the base (for data
+   that was moved) */
+static void make_patch(PATCH *patch, const uint8_t *base, size_t base_size,
+                       const uint8_t *target, size_t target_size)
+{
+    assert(DELTA_WINDOW == 16);     /* the hash reads two 64-bit words */
+    memset(patch, 0, sizeof(PATCH));
+    patch_number(patch, target_size);
+    patch_number(patch, base_size);
+    size_t flags = patch->size;
+    *patch_reserve(patch, 1) = DELTA_INPLACE;
+
+    unsigned int bits = 10;
+    while (bits < 30 && ((size_t)1 << bits) < base_size / DELTA_WINDOW * 2)
+        bits++;
+    size_t *table = malloc(((size_t)1 << bits) * sizeof(size_t));
+    if (table == NULL)
+        fatal("Memory allocation error.");
+    memset(table, 0xff, ((size_t)1 << bits) * sizeof(size_t));
+    for (size_t pos = 0; pos + DELTA_WINDOW <= base_size; pos += DELTA_WINDOW) {
+        size_t *slot = &table[delta_hash(base + pos, bits)];
+        if (*slot == SIZE_MAX)
+            *slot = pos;
+    }
+
+    size_t pos = 0, literal = 0;    /* "literal" is the start of the pending literal */
+    int64_t distance = 0;
+    while (pos < target_size) {
+        size_t source = 0, length = 0;
+        int64_t expect = (int64_t)pos + distance;
+        if (expect >= 0 && (uint64_t)expect < base_size) {
+            source = (size_t)expect;
+            size_t limit = base_size - source;
+            if (limit > target_size - pos)
+                limit = target_size - pos;
+            length = match_length(base + source, target + pos, limit);
+            if (length < DELTA_MIN_MATCH)
+                length = 0;
+        }
+        if (length == 0 && pos + DELTA_WINDOW <= target_size) {
+            size_t candidate = table[delta_hash(target + pos, bits)];
+            if (candidate != SIZE_MAX) {
+                size_t limit = base_size - candidate;
+                if (limit > target_size - pos)
+                    limit = target_size - pos;
+                length = match_length(base + candidate, target + pos, limit);
+                if (length >= DELTA_WINDOW)
+                    source = candidate;
+                else
+                    length = 0;
+            }
+        }
+        if (length == 0) {
+            pos++;
+            continue;
+        }
+        /* extend the match backwards, into the pending literal */
+        while (pos > literal && source > 0 && base[source - 1] == target[pos - 1]) {
+            pos--;
+            source--;
+            length++;
+        }
+        patch_literal(patch, target + literal, pos - literal);
+        distance = (int64_t)source - (int64_t)pos;
+        patch_number(patch, (uint64_t)length << 1);
+        patch_number(patch, (distance < 0) ? ((uint64_t)(-(distance + 1)) << 1) | 1 : (uint64_t)distance << 1);
+        if (distance < 0)
+            patch->data[flags] &= ~DELTA_INPLACE;
+        pos += length;
+        literal = pos;
+    }
+    patch_literal(patch, target + literal, target_size - literal);
+    free(table);
+}
+
+/* delta_input() replaces the input by a patch against the base file; it
+   returns the size of the patch (plus the zero terminator, if requested), and
+   it sets the size of the input file and of the base file */
+static uint64_t delta_input(INPUT *input, const OPTIONS *opts, uint64_t *patched_size,
+                            uint64_t *base_size)
+{
+    FILE *fp = fopen(opts->base, "rb");
+    if (fp == NULL)
+        fatal("Failed to open %s for reading.", opts->base);
+    INPUT base;
+    input_init(&base, fp, true, INPUT_BLOCK);
+    stats_enter(PHASE_READ);
+    if (!input_gather(input) || !input_gather(&base))
+        fatal("Failed to read the input file or %s.", opts->base);
+    stats_leave();
+    stats.files++;
+    stats_enter(PHASE_COMPRESS);
+    PATCH patch;
+    const size_t size = input->view_size - input->view_pos;
+    make_patch(&patch, base.view, base.view_size, input->view + input->view_pos, size);
+    stats_leave();
+    *patched_size = size;
+    *base_size = base.view_size;
+    /* the patch is counted again when it is read */
+    stats.bytes_in += size + base.view_size - patch.size;
+    size_t blocksize = input->blocksize;
+    input_close(&base);
+    input_close(input);
+    input_memory(input, patch.data, patch.size, blocksize);
+    return patch.size + (opts->zero_terminate ? 1 : 0);
+}
+
+/* open_input() opens the input file for reading, and returns its size (plus 1
+   for the zero terminator, if requested); the name "-" is standard input */
+static uint64_t open_input(INPUT *input, const char *inputname, const OPTIONS *opts)
+{
+    size_t blocksize = (opts->jobs > 1) ? (size_t)opts->jobs * JOB_BLOCK : INPUT_BLOCK;
+    if (strcmp(inputname, "-") == 0) {
+#if defined _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        stats_enter(PHASE_READ);
+        input_spool(input, stdin, blocksize);
+        if (opts->is_textfile)
+            input_text(input);
+        stats_leave();
+        return input->view_size + (opts->zero_terminate ? 1 : 0);
+    }
+    stats_enter(PHASE_OPEN);
+    FILE *fp = fopen(inputname, "rb");
+    if (fp == NULL)
+        fatal("Failed to open %s for reading.", inputname);
+
+    uint64_t file_size = file_length(fp);
+    const bool regular = regular_file(fp);
+    input_init(input, fp, true, blocksize);
+    stats_leave();
+    if (opts->is_textfile || !regular) {
+        /* the size after translation is only known when the file was read; a
+           pipe or a device (like "/dev/stdin") is read completely, as is
+           standard input */
+        stats_enter(PHASE_READ);
+        if (!input_gather(input))
+            fatal("Failed to read %s.", inputname);
+        if (opts->is_textfile)
+            input_text(input);
+        stats_leave();
+        file_size = input->view_size;
+    }
+    if (opts->zero_terminate)
+        file_size += 1;
+    return file_size;
+}
+
+/* copy_input() reads the file in blocks and emits each block directly (or
+   passes it through the compressor, if "stream" is not NULL); it continues
+   from "*position" up to "end", where the input has "data_size" bytes and
+   zeros follow */
+static void copy_input(INPUT *input, EMITTER *emit, STREAM *stream, uint64_t *position,
+                       uint64_t end, uint64_t data_size)
+{
+    uint64_t count = *position;
+    uint64_t limit = (data_size < end) ? data_size : end;
+    while (count < limit) {
+        const uint8_t *data;
+        uint64_t remaining = limit - count;
+        size_t size = input_read(input, &data, (remaining < SIZE_MAX) ? (size_t)remaining : SIZE_MAX);
+        if (size == 0)
+            break;
+        if (stream != NULL)
+            stream_write(stream, data, size, false);
+        else
+            emit_data(emit, data, size);
+        count += size;
+    }
+    static const uint8_t zeros[ROW_BYTES];
+    while (count < end) {
+        size_t size = (end - count < sizeof zeros) ? (size_t)(end - count) : sizeof zeros;
+        if (stream != NULL)
+            stream_write(stream, zeros, size, false);
+        else
+            emit_data(emit, zeros, size);
+        count += size;
+    }
+    *position = count;
+}
+
+/* output_size() declares a size constant, as a macro, as an external symbol
+   (for the incbin format), or as a constant (qualified for C++ mode); sizes that do not fit in 32 bits
+   are declared as uint64_t (smaller sizes remain "unsigned int") */
+static void output_size(OUTPUT *output, const OPTIONS *opts, const char *symbolname, const char *suffix,
+                        uint64_t value, bool as_macro, bool as_extern)
+{
+    const char *type = (value > UINT32_MAX) ? "uint64_t" : "unsigned int";
+    if (as_macro)
+        output_printf(output, "#define %s%s %" PRIu64 "\n", symbolname, suffix, value);
+    else if (as_extern)
+        output_printf(output, "extern const %s %s%s;\n", type, symbolname, suffix);
+    else
+        output_printf(output, "%s%s %s%s = %" PRIu64 ";\n", const_qualifier(opts), type, symbolname, suffix, value);
+}
+
+/* write_parts() emits the data of the input file (up to "data_size", and then
+   zeros up to "padded_size") in sub-arrays of at most the split size each,
+   followed by a table with pointers to the sub-arrays; with shards, the
+   sub-arrays are distributed over that many .c files (next to the output
+   file) and the output gets declarations; it returns the number of sub-arrays
+   and sets "part_size" to the number of elements in a sub-array */
+static unsigned int write_parts(OUTPUT *output, const OPTIONS *opts, const char *f_outputname,
+                                INPUT *input, const char *symbolname, uint64_t data_size,
+                                uint64_t padded_size, uint64_t *part_size)
+{
+    const unsigned int bitsize = opts->bitsize;
+    const unsigned int wordsize = bitsize >> 3;
+    uint64_t split = opts->split_size;
+    if (split == 0) {
+        /* one sub-array per shard, in whole rows */
+        assert(opts->shards > 0);
+        split = (padded_size + opts->shards - 1) / opts->shards;
+        split = (split + ROW_BYTES - 1) & ~(uint64_t)(ROW_BYTES - 1);
+        if (split == 0)
+            split = ROW_BYTES;  /* empty file */
+    }
+    split -= split % wordsize;
+    if (split == 0)
+        fatal("The split size must be at least the size of an element.");
+    if (opts->format == FORMAT_STRING && split >= STRING_MAX)
+        fatal("The 'string' format is limited to %u bytes per sub-array (option --split).", STRING_MAX - 1);
+    uint64_t parts = (padded_size + split - 1) / split;
+    if (parts == 0)
+        parts = 1;  /* an empty file still gets a (single) sub-array */
+    if (parts > UINT_MAX)
+        fatal("Too many sub-arrays, the split size is too small.");
+
+    const unsigned int shards = (opts->shards > 0) ? opts->shards : 1;
+    uint64_t position = 0;
+    unsigned int part = 0;
+    for (unsigned int shard = 0; shard < shards; shard++) {
+        /* each shard gets a contiguous range of sub-arrays (a shard may be
+           empty, but all shards are created, for the sake of the makefile) */
+        unsigned int last = (unsigned int)(parts * (shard + 1) / shards);
+        OUTPUT shard_output;
+        OUTPUT *out = output;
+        if (opts->shards > 0) {
+            char suffix[32];
+            sprintf(suffix, "_%u.c", shard);
+            char *name = data_filename(f_outputname, symbolname, suffix);
+            output_init(&shard_output, NULL);
+            output_open(&shard_output, name, false);
+            free(name);
+            output_banner(&shard_output);
+            output_printf(&shard_output, "#include <stdint.h>\n\n");
+            out = &shard_output;
+        }
+        for ( ; part < last; part++) {
+            uint64_t end = (padded_size - position > split) ? position + split : padded_size;
+            uint64_t count = (opts->format == FORMAT_STRING) ? end - position + 1
+                                                              : (end - position + wordsize - 1) / wordsize;
+            if (opts->shards > 0)
+                output_printf(output, "extern %suint%u_t %s_part%u[%" PRIu64 "];\n",
+                              opts->is_mutable ? "" : "const ", bitsize, symbolname, part, count);
+            output_declspec(out, opts);
+            if (opts->format == FORMAT_STRING)
+                output_printf(out, "uint8_t %s_part%u[%" PRIu64 "] =", symbolname, part, count);
+            else
+                output_printf(out, "uint%u_t %s_part%u[%" PRIu64 "] = {", bitsize, symbolname, part, count);
+            EMITTER emitter;
+            emit_init(&emitter, out, opts->format, bitsize, opts->big_endian, opts->jobs);
+            copy_input(input, &emitter, NULL, &position, end, data_size);
+            emit_finish(&emitter);
+            output_printf(out, (opts->format == FORMAT_STRING) ? ";\n\n" : "\n};\n\n");
+        }
+        if (opts->shards > 0) {
+            output_done(&shard_output);
+            output_close(&shard_output);
+        }
+    }
+    if (opts->shards > 0)
+        output_printf(output, "\n");
+
+    output_printf(output, "%suint%u_t *const %s_parts[%u] = {", opts->is_mutable ? "" : "const ",
+                  bitsize, symbolname, (unsigned int)parts);
+    for (unsigned int idx = 0; idx < parts; idx++)
+        output_printf(output, "%s%s_part%u", (idx == 0) ? "\n\t" : (idx % 8 == 0) ? ",\n\t" : ", ",
+                      symbolname, idx);
+    output_printf(output, "\n};\n");
+    *part_size = split / wordsize;
+    return (unsigned int)parts;
+}
+
+/* select_codec() returns the codec for the options (or NULL for none), and
+   checks the compression level */
+static const CODEC *select_codec(const OPTIONS *opts, int *level)
+{
+    if (opts->codec == CODEC_NONE) {
+        if (opts->block_size > 0)
+            fatal("Option --blocksize requires compression (option --compress).");
+        return NULL;
+    }
+    const CODEC *codec = &codecs[opts->codec];
+    assert(codec->init != NULL);
+    *level = opts->level_set ? opts->level : codec->default_level;
+    if (*level < codec->min_level || *level > codec->max_level)
+        fatal("Invalid compression level %d for %s (must be %d..%d).", *level, codec->name,
+              codec->min_level, codec->max_level);
+    return codec;
+}
+
+/* emit_codecs() writes the codec identifiers, once per output file */
+static void emit_codecs(OUTPUT *output)
+{
+    if ((output->emitted & EMITTED_CODECS) == 0) {
+        output_printf(output, "\n\n#ifndef BIN2C_CODEC_NONE\n");
+        for (int idx = 0; idx < CODEC_COUNT; idx++)
+            output_printf(output, "#define %-20s %d\n", codecs[idx].macro, idx);
+        output_printf(output, "#endif");
+        output->emitted |= EMITTED_CODECS;
+    }
+}
+
+/* emit_decompress() writes the decompression helper, once per output file */
+static void emit_decompress(OUTPUT *output)
+{
+    if ((output->emitted & EMITTED_DECOMPRESS) == 0) {
+        output_printf(output, "\n");
+        output_write(output, decompress_helper, strlen(decompress_helper));
+        output->emitted |= EMITTED_DECOMPRESS;
+    }
+}
+
+/* emit_accessor() writes the accessor functions for a symbol (plus the helpers
+   that they use, once per output file); "data_size" is the size of the data in
+   bytes (compressed, if a codec is set). In C++ mode, the functions are inline
+   functions with external linkage, so that there is a single cache for the
+   whole program. */
+static void emit_accessor(OUTPUT *output, const OPTIONS *opts, const char *symbolname,
+                          const CODEC *codec, uint64_t data_size, bool has_index)
+{
+    emit_codecs(output);
+    emit_decompress(output);
+    if ((output->emitted & EMITTED_ACCESSOR) == 0) {
+        output_printf(output, "\n");
+        output_write(output, accessor_helper, strlen(accessor_helper));
+        output->emitted |= EMITTED_ACCESSOR;
+    }
+    if (has_index && (output->emitted & EMITTED_PAGER) == 0) {
+        output_printf(output, "\n");
+        output_write(output, pager_helper, strlen(pager_helper));
+        output->emitted |= EMITTED_PAGER;
+    }
+    const char *linkage = opts->cpp ? "inline" : "static inline";
+    const char *data = uses_std_array(opts) ? ".data()" : "";
+    output_printf(output, "\n");
+    output_namespace(output, opts, true);
+    output_printf(output, "%s const void *%s_data(void *buffer)\n{\n", linkage, symbolname);
+    if (codec != NULL) {
+        output_printf(output, "    static bin2c_cache cache;\n"
+                              "    return bin2c_load(&cache, buffer, %s, %" PRIu64 ", %s%s, %s%s,\n"
+                              "                      %s_size_uncompressed, %s_codec);\n",
+                      symbolname, data_size, has_index ? symbolname : "0", has_index ? "_index" : "",
+                      has_index ? symbolname : "0", has_index ? "_block_size" : "", symbolname, symbolname);
+    } else {
+        output_printf(output, "    (void)buffer;   /* the data is not compressed */\n"
+                              "    return %s%s;\n", symbolname, data);
+    }
+    output_printf(output, "}\n\n%s int %s_open(bin2c_reader *reader)\n{\n", linkage, symbolname);
+    if (codec != NULL)
+        output_printf(output, "    return bin2c_reader_open(reader, %s, %" PRIu64 ", %s_size_uncompressed, %s_codec);\n",
+                      symbolname, data_size, symbolname, symbolname);
+    else
+        output_printf(output, "    return bin2c_reader_open(reader, %s%s, %" PRIu64 ", %" PRIu64 ", BIN2C_CODEC_NONE);\n",
+                      symbolname, data, data_size, data_size);
+    output_printf(output, "}\n");
+    if (has_index)
+        output_printf(output, "\n%s int %s_pager(bin2c_pager *pager, unsigned int pages)\n{\n"
+                              "    return bin2c_pager_open(pager, %s, %s_index, %s_block_size,\n"
+                              "                            %s_size_uncompressed, %s_codec, pages);\n}\n",
+                      linkage, symbolname, symbolname, symbolname, symbolname, symbolname, symbolname);
+    output_namespace(output, opts, false);
+}
+
+/* emit_patch() writes the sizes for a patch against a base file, and a function
+   that applies the patch (plus the helper, once per output file); the function
+   is only written if the patch is not compressed */
+static void emit_patch(OUTPUT *output, const OPTIONS *opts, const char *symbolname, const CODEC *codec,
+                       uint64_t data_size, uint64_t patched_size, uint64_t base_size)
+{
+    if ((output->emitted & EMITTED_PATCH) == 0) {
+        output_printf(output, "\n");
+        output_write(output, patch_helper, strlen(patch_helper));
+        output->emitted |= EMITTED_PATCH;
+    }
+    bool as_macro = opts->use_macro || opts->format == FORMAT_INCBIN;
+    output_printf(output, "\n");
+    output_namespace(output, opts, true);
+    output_size(output, opts, symbolname, "_size_patched", patched_size, as_macro, false);
+    output_size(output, opts, symbolname, "_size_base", base_size, as_macro, false);
+    if (codec == NULL)
+        output_printf(output, "\n%s size_t %s_patch(void *buffer, const void *base)\n{\n"
+                              "    return bin2c_patch(buffer, %s_size_patched, base, %s_size_base, %s%s, %" PRIu64 ");\n}\n",
+                      opts->cpp ? "inline" : "static inline", symbolname, symbolname, symbolname, symbolname,
+                      uses_std_array(opts) ? ".data()" : "", data_size);
+    output_namespace(output, opts, false);
+}
+
+/* convert() converts a single input file, and appends the declarations to the
+   output (which must already be open); "append_asm" is true if an assembler
+   file that goes with the output was already created */
+static void convert(const OPTIONS *opts, const char *f_inputname, const char *f_outputname,
+                    OUTPUT *output, bool append_asm)
+{
+    const bool is_mutable = opts->is_mutable;
+    const bool use_macro = opts->use_macro;
+    const bool zero_terminate = opts->zero_terminate;
+    const unsigned int bitsize = opts->bitsize;
+    const unsigned int jobs = opts->jobs;
+    const int format = opts->format;
+
+    /* the options are checked before the input file is opened */
+    if ((format == FORMAT_EMBED || format == FORMAT_STRING) && bitsize != 8)
+        fatal("The '%s' format requires a bit size of 8.", (format == FORMAT_EMBED) ? "embed" : "string");
+    int level = 0;
+    const CODEC *codec = select_codec(opts, &level);
+    const bool split = (opts->split_size > 0 || opts->shards > 0);
+    if (split && (codec != NULL || (format != FORMAT_ARRAY && format != FORMAT_STRING)))
+        fatal("Options --split and --shards require the 'array' or 'string' format, without compression.");
+    if (split && opts->accessor)
+        fatal("Option --accessor cannot be combined with --split or --shards.");
+    if (opts->sparse && (codec != NULL || format != FORMAT_ARRAY || split))
+        fatal("Option --sparse requires the 'array' format, without compression or --split.");
+    if (opts->cpp && (format == FORMAT_INCBIN || split || opts->sparse))
+        fatal("Option --cpp cannot be combined with the 'incbin' format, --split, --shards or --sparse.");
+    if (opts->base != NULL && split)
+        fatal("Option --base cannot be combined with --split or --shards.");
+    char *symbolname = make_symbolname(opts->label, f_inputname);
+
+    INPUT input;
+    uint64_t file_size = open_input(&input, f_inputname, opts);
+    stats.files++;
+    uint64_t patched_size = 0, base_size = 0;
+    if (opts->base != NULL)
+        file_size = delta_input(&input, opts, &patched_size, &base_size);
+    if (opts->block_size > 0 && file_size > UINT32_MAX)
+        fatal("Option --blocksize is limited to input files of up to 4 GiB (%s).", f_inputname);
+    if (format == FORMAT_STRING && !split && codec == NULL && file_size - (zero_terminate ? 1 : 0) >= STRING_MAX)
+        fatal("The 'string' format is limited to %u bytes per array, use --split for %s.",
+              STRING_MAX - 1, f_inputname);
+    if (codec != NULL)
+        emit_codecs(output);
+    output_printf(output, "\n\n");
+    assert(bitsize == 8 || bitsize == 16 || bitsize == 32 || bitsize == 64);
+    uint64_t array_size = (file_size + ((bitsize >> 3) - 1)) / (bitsize >> 3);
+    EMITTER emitter;
+    emit_init(&emitter, output, format, bitsize, opts->big_endian, opts->sparse ? 1 : jobs);
+    emitter.sparse = opts->sparse;
+    uint64_t data_size = zero_terminate ? file_size - 1 : file_size;
+    /* for the incbin and embed formats, the input file is included as is, or
+       the transformed data is stored in a separate file, to be included
+       instead */
+    char *dataname = NULL;
+    char *blobname = NULL;
+    OUTPUT blob;
+    const bool use_blob = uses_blob(opts);
+    uint64_t blob_hash;
+    bool emit_array = true; /* whether the data must be processed by the emitter */
+    if (format == FORMAT_INCBIN || format == FORMAT_EMBED) {
+        if (use_blob) {
+            /* the full path of the data file is only known once the file
+               exists under its real name */
+            emitter.blob = &blob;
+            blobname = data_filename(f_outputname, symbolname, ".blob");
+            output_init(&blob, NULL);
+            output_open(&blob, blobname, false);
+        } else {
+            dataname = full_path(f_inputname);
+            emit_array = false;
+        }
+    }
+    /* the size of compressed data is only known at the end, so the array is
+       declared without size (the declarations for the incbin and embed formats
+       are written after the data file is complete); data that is split in
+       sub-arrays is written completely by write_parts() */
+    output_namespace(output, opts, true);
+    unsigned int parts = 0;
+    uint64_t part_size = 0;
+    if (split) {
+        parts = write_parts(output, opts, f_outputname, &input, symbolname, data_size,
+                            (format == FORMAT_STRING) ? data_size : file_size, &part_size);
+        emit_array = false;
+    } else if (format == FORMAT_STRING) {
+        /* the string literal has a terminating zero of its own, which is the
+           zero terminator if one was requested (so it is not emitted) */
+        output_declspec(output, opts);
+        if (codec != NULL)
+            output_printf(output, "uint8_t %s[] =", symbolname);
+        else
+            output_printf(output, "uint8_t %s[%" PRIu64 "] =", symbolname, data_size + 1);
+    } else if (format == FORMAT_ARRAY) {
+        output_declspec(output, opts);
+        if (uses_std_array(opts))
+            output_printf(output, "std::array<uint%u_t, %" PRIu64 "> %s = {", bitsize, array_size, symbolname);
+        else if (codec != NULL)
+            output_printf(output, "uint%u_t %s[] = {", bitsize, symbolname);
+        else
+            output_printf(output, "uint%u_t %s[%" PRIu64 "] = {", bitsize, symbolname, array_size);
+    }
+
+    /* the carry-over of incomplete words between blocks is handled by the
+       emitter; the zero terminator (if requested) is part of the padding, but
+       a string literal has a zero of its own (a compressed string needs the
+       terminator too, because that zero is not part of the compressed data) */
+    STREAM stream;
+    memset(&stream, 0, sizeof(STREAM));
+    if (codec != NULL)
+        stream_open(&stream, codec, level, file_size, opts->block_size, jobs, &emitter);
+    if (emit_array) {
+        uint64_t position = 0;
+        copy_input(&input, &emitter, (codec != NULL) ? &stream : NULL, &position,
+                   (format == FORMAT_STRING && codec == NULL) ? data_size : file_size, data_size);
+    }
+    input_close(&input);
+    uint64_t uncompressed_size = 0;
+    if (codec != NULL) {
+        stream_write(&stream, NULL, 0, true);
+        stream_close(&stream);
+        if (stream.index != NULL && stream.total > UINT32_MAX)
+            fatal("The compressed data of %s is too large for a block index.", f_inputname);
+        if (format == FORMAT_STRING && stream.total >= STRING_MAX)
+            fatal("The compressed data of %s is too large for the 'string' format (%u bytes at most).",
+                  f_inputname, STRING_MAX - 1);
+        uncompressed_size = file_size;
+        file_size = data_size = stream.total;
+        array_size = (file_size + ((bitsize >> 3) - 1)) / (bitsize >> 3);
+    }
+    if (parts == 0)
+        emit_finish(&emitter);
+    else
+        emit_free(&emitter);
+    if (emitter.blob != NULL) {
+        output_done(&blob);
+        output_close(&blob);
+        dataname = full_path(blobname);
+        if (has_banner_hash) {
+            HASH hash;
+            hash_init(&hash);
+            hash_file(&hash, blobname);
+            blob_hash = hash_final(&hash);
+        }
+        free(blobname);
+    }
+
+    if (format == FORMAT_INCBIN || format == FORMAT_EMBED) {
+        /* when the input file is included as is, the zero terminator and the
+           padding to a whole number of words are appended in the assembler
+           file or the #embed directive */
+        unsigned int padding = use_blob ? 0 : (unsigned int)(array_size * (bitsize >> 3) - data_size);
+        if (format == FORMAT_INCBIN) {
+            char *asmname = replace_extension(f_outputname, ".S");
+            write_incbin(asmname, append_asm, dataname, (use_blob && has_banner_hash) ? &blob_hash : NULL,
+                         symbolname, opts, padding, array_size, stream.index, stream.blocks + 1);
+            free(asmname);
+            output_printf(output, "extern %suint%u_t %s[%" PRIu64 "];\n", is_mutable ? "" : "const ",
+                          bitsize, symbolname, array_size);
+        } else {
+            /* the name in an #embed directive has no escape sequences */
+            if (strpbrk(dataname, "\"\n") != NULL)
+                fatal("The path %s cannot be used in an #embed directive.", dataname);
+            output_declspec(output, opts);
+            output_printf(output, "uint8_t %s[%" PRIu64 "] = {\n#embed \"%s\"",
+                          symbolname, array_size, dataname);
+            output_data_hash(output, symbolname, (use_blob && has_banner_hash) ? &blob_hash : NULL);
+            if (padding > 0)
+                output_printf(output, " suffix(, 0)");
+            output_printf(output, "\n");
+        }
+        free(dataname);
+    }
+    if (parts > 0) {
+        /* the closing braces were written with the sub-arrays */
+    } else if (format == FORMAT_ARRAY) {
+        output_printf(output, "\n};\n\n");
+    } else if (format == FORMAT_EMBED) {
+        output_printf(output, "};\n\n");
+    } else if (format == FORMAT_STRING) {
+        output_printf(output, ";\n\n");
+    }
+    output_size(output, opts, symbolname, "_size", array_size, use_macro, format == FORMAT_INCBIN);
+    if (parts > 0) {
+        output_size(output, opts, symbolname, "_part_size", part_size, use_macro, false);
+        output_size(output, opts, symbolname, "_part_count", parts, use_macro, false);
+    }
+
+    if (codec != NULL) {
+        output_size(output, opts, symbolname, "_size_uncompressed", uncompressed_size,
+                    use_macro || format == FORMAT_INCBIN, false);
+        if (use_macro || format == FORMAT_INCBIN)
+            output_printf(output, "#define %s_codec %s\n", symbolname, codec->macro);
+        else
+            output_printf(output, "%sunsigned int %s_codec = %s;\n", const_qualifier(opts), symbolname, codec->macro);
+    }
+    if (stream.index != NULL) {
+        if (use_macro || format == FORMAT_INCBIN)
+            output_printf(output, "#define %s_block_size %u\n", symbolname, (unsigned int)opts->block_size);
+        else
+            output_printf(output, "%sunsigned int %s_block_size = %u;\n", const_qualifier(opts), symbolname,
+                          (unsigned int)opts->block_size);
+        if (format == FORMAT_INCBIN) {
+            output_printf(output, "extern const unsigned int %s_index[%u];\n", symbolname, stream.blocks + 1);
+        } else {
+            output_printf(output, "%sunsigned int %s_index[%u] = {", const_qualifier(opts), symbolname, stream.blocks + 1);
+            for (unsigned int idx = 0; idx <= stream.blocks; idx++)
+                output_printf(output, "%s%" PRIu32, (idx == 0) ? "\n\t" : (idx % 8 == 0) ? ",\n\t" : ", ",
+                              stream.index[idx]);
+            output_printf(output, "\n};\n");
+        }
+    }
+    if (opts->cpp)
+        output_printf(output, "#ifdef BIN2C_SPAN\n"
+                              "inline constexpr std::span<%suint%u_t> %s_span{%s};\n"
+                              "#endif\n", is_mutable ? "" : "const ", bitsize, symbolname, symbolname);
+    output_namespace(output, opts, false);
+    if (stream.index != NULL) {
+        if ((output->emitted & EMITTED_BLOCKS) == 0) {
+            emit_decompress(output);
+            output_printf(output, "\n");
+            output_write(output, read_block_helper, strlen(read_block_helper));
+            output->emitted |= EMITTED_BLOCKS;
+        }
+        free(stream.index);
+    }
+    if (opts->base != NULL)
+        emit_patch(output, opts, symbolname, codec, data_size, patched_size, base_size);
+    if (opts->accessor)
+        emit_accessor(output, opts, symbolname, codec, data_size, stream.index != NULL);
+
+    free(symbolname);
+}
+
+/* hash_options() adds the options that affect the generated data to the hash */
+static void hash_options(HASH *hash, const OPTIONS *opts)
+{
+    uint32_t values[] = { opts->format, opts->bitsize, opts->is_textfile, opts->is_mutable,
+                          opts->use_macro, opts->zero_terminate, opts->codec,
+                          opts->level_set ? (uint32_t)opts->level : UINT32_MAX,
+                          (uint32_t)opts->block_size, opts->align, opts->big_endian,
+                          (uint32_t)opts->split_size, (uint32_t)(opts->split_size >> 32),
+                          opts->shards, opts->accessor, opts->sparse, opts->cpp };
+    hash_update(hash, values, sizeof values);
+    const char *section = (opts->section != NULL) ? opts->section : "";
+    hash_update(hash, section, strlen(section) + 1);
+    const char *space = (opts->cpp_namespace != NULL) ? opts->cpp_namespace : "";
+    hash_update(hash, space, strlen(space) + 1);
+    if (opts->base != NULL) {
+        hash_update(hash, opts->base, strlen(opts->base) + 1);
+        hash_file(hash, opts->base);
+    }
+}
+
+/* Duplicate detection: files are first compared on a hash of their contents
+   and of the options that affect the generated data (a key), and files with
+   the same key are then compared byte by byte. */
+static uint64_t content_key(const char *filename, const OPTIONS *opts)
+{
+    HASH hash;
+    hash_init(&hash);
+    hash_options(&hash, opts);
+    hash_file(&hash, filename);
+    return hash_final(&hash);
+}
+
+static bool same_contents(const char *name1, const char *name2)
+{
+    INPUT in1, in2;
+    FILE *fp1 = fopen(name1, "rb");
+    if (fp1 == NULL)
+        fatal("Failed to open %s for reading.", name1);
+    input_init(&in1, fp1, true, INPUT_BLOCK);
+    FILE *fp2 = fopen(name2, "rb");
+    if (fp2 == NULL)
+        fatal("Failed to open %s for reading.", name2);
+    input_init(&in2, fp2, true, INPUT_BLOCK);
+    bool same = true;
+    const uint8_t *data1 = NULL, *data2 = NULL;
+    size_t size1 = 0, size2 = 0;
+    while (same) {
+        if (size1 == 0)
+            size1 = input_read(&in1, &data1, INPUT_BLOCK);
+        if (size2 == 0)
+            size2 = input_read(&in2, &data2, INPUT_BLOCK);
+        if (size1 == 0 || size2 == 0) {
+            same = (size1 == size2);
+            break;
+        }
+        size_t count = (size1 < size2) ? size1 : size2;
+        same = (memcmp(data1, data2, count) == 0);
+        data1 += count;
+        data2 += count;
+        size1 -= count;
+        size2 -= count;
+    }
+    input_close(&in1);
+    input_close(&in2);
+    return same;
+}
+
+/* is_directory() returns whether the path is an existing directory */
+static bool is_directory(const char *path)
+{
+#if defined _WIN32
+    DWORD attribs = GetFileAttributesA(path);
+    return attribs != INVALID_FILE_ATTRIBUTES && (attribs & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#elif defined __unix__ || defined __APPLE__
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void add_name(char ***names, unsigned int *count, unsigned int *size, const char *name)
+{
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        return;
+    if (*count == *size) {
+        *size = (*size == 0) ? 16 : 2 * *size;
+        *names = realloc(*names, *size * sizeof(char *));
+        if (*names == NULL)
+            fatal("Memory allocation error.");
+    }
+    (*names)[*count] = strdup(name);
+    if ((*names)[*count] == NULL)
+        fatal("Memory allocation error.");
+    (*count)++;
+}
+
+/* add_directory() adds entries for all files in the directory and in its
+   subdirectories; the names are sorted, so that the order of the files does
+   not depend on the file system */
+static void add_directory(ENTRYLIST *list, const char *path, const OPTIONS *opts)
+{
+    char **names = NULL;
+    unsigned int count = 0, size = 0;
+#if defined _WIN32
+    char *pattern = malloc(strlen(path) + 3);
+    if (pattern == NULL)
+        fatal("Memory allocation error.");
+    sprintf(pattern, "%s/*", path);
+    WIN32_FIND_DATAA data;
+    HANDLE hfind = FindFirstFileA(pattern, &data);
+    free(pattern);
+    if (hfind == INVALID_HANDLE_VALUE)
+        fatal("Failed to read directory %s.", path);
+    do {
+        add_name(&names, &count, &size, data.cFileName);
+    } while (FindNextFileA(hfind, &data));
+    FindClose(hfind);
+#elif defined __unix__ || defined __APPLE__
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        fatal("Failed to read directory %s.", path);
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL)
+        add_name(&names, &count, &size, dirent->d_name);
+    closedir(dir);
+#else
+    fatal("Failed to read directory %s.", path);
+#endif
+    if (count > 0)
+        qsort(names, count, sizeof(char *), compare_names);
+    size_t length = strlen(path);
+    bool has_separator = length > 0 && (path[length - 1] == '/' || path[length - 1] == '\\');
+    for (unsigned int idx = 0; idx < count; idx++) {
+        char *fullname = malloc(length + strlen(names[idx]) + 2);
+        if (fullname == NULL)
+            fatal("Memory allocation error.");
+        sprintf(fullname, has_separator ? "%s%s" : "%s/%s", path, names[idx]);
+        free(names[idx]);
+        if (is_directory(fullname)) {
+            add_directory(list, fullname, opts);
+            free(fullname);
+        } else {
+            ENTRY *entry = add_entry(list, fullname, opts);
+            entry->storage = fullname;
+        }
+    }
+    free(names);
+}
+
+/* In a bundle, all files are packed in a single array, followed by a directory
+   with an entry for each file. The directory is ordered on a minimal perfect
+   hash of the paths, so that the generated lookup function finds a file with
+   a single string comparison. */
+#define BUNDLE_ALIGN    16      /* alignment of each file in the bundle */
+
+typedef struct tagRESOURCE {
+    char *path;
+    const char *inputname;
+    uint64_t key;               /* for detecting duplicates */
+    uint64_t offset;
+    unsigned int size;          /* size in the bundle */
+    unsigned int size_uncompressed;
+    int codec;
+} RESOURCE;
+
+/* bundle_hash() is the hash function for the directory, it must give the same
+   result as bin2c_hash() in the generated code */
+static uint32_t bundle_hash(const char *key, uint32_t seed)
+{
+    uint32_t h = UINT32_C(2166136261) ^ seed;
+    while (*key != '\0')
+        h = (h ^ (uint8_t)*key++) * UINT32_C(16777619);
+    h ^= h >> 16;
+    h *= UINT32_C(0x7feb352d);
+    h ^= h >> 15;
+    h *= UINT32_C(0x846ca68b);
+    h ^= h >> 16;
+    return h;
+}
+
+typedef struct tagBUCKET {
+    unsigned int index;
+    unsigned int size;
+    unsigned int first;         /* index of the first key in the sorted key list */
+} BUCKET;
+
+static int compare_buckets(const void *a, const void *b)
+{
+    const BUCKET *b1 = a, *b2 = b;
+    if (b1->size != b2->size)
+        return (b1->size > b2->size) ? -1 : 1;  /* largest buckets first */
+    return (b1->index < b2->index) ? -1 : (b1->index > b2->index);
+}
+
+/* build_phf() builds a minimal perfect hash for the paths of the resources: a
+   path is in bucket bundle_hash(path, 0) % count; the displacement of a bucket
+   is either the seed for the second hash (which gives the slot), or the slot
+   itself (stored as -slot - 1) for buckets with a single path; "slots" is set
+   to the slot of each resource */
+static void build_phf(const RESOURCE *resources, unsigned int count, int32_t *displace,
+                      unsigned int *slots)
+{
+    BUCKET *buckets = calloc(count, sizeof(BUCKET));
+    unsigned int *keys = malloc(count * sizeof(unsigned int));  /* keys sorted on bucket */
+    unsigned int *hashes = malloc(count * sizeof(unsigned int));
+    bool *taken = calloc(count, sizeof(bool));
+    if (buckets == NULL || keys == NULL || hashes == NULL || taken == NULL)
+        fatal("Memory allocation error.");
+    for (unsigned int idx = 0; idx < count; idx++) {
+        hashes[idx] = bundle_hash(resources[idx].path, 0) % count;
+        buckets[hashes[idx]].size++;
+    }
+    unsigned int first = 0;
+    for (unsigned int idx = 0; idx < count; idx++) {
+        buckets[idx].index = idx;
+        buckets[idx].first = first;
+        first += buckets[idx].size;
+        buckets[idx].size = 0;
+        displace[idx] = 0;
+    }
+    for (unsigned int idx = 0; idx < count; idx++) {
+        BUCKET *bucket = &buckets[hashes[idx]];
+        for (unsigned int j = 0; j < bucket->size; j++)
+            if (strcmp(resources[keys[bucket->first + j]].path, resources[idx].path) == 0)
+                fatal("Duplicate file %s in the bundle.", resources[idx].path);
+        keys[bucket->first + bucket->size++] = idx;
+    }
+    qsort(buckets, count, sizeof(BUCKET), compare_buckets);
+
+    unsigned int freeslot = 0;
+    for (unsigned int idx = 0; idx < count && buckets[idx].size > 0; idx++) {
+        const BUCKET *bucket = &buckets[idx];
+        const unsigned int *members = &keys[bucket->first];
+        if (bucket->size == 1) {
+            while (taken[freeslot])
+                freeslot++;
+            taken[freeslot] = true;
+            slots[members[0]] = freeslot;
+            displace[bucket->index] = -(int32_t)freeslot - 1;
+            continue;
+        }
+        int32_t seed;
+        for (seed = 1; seed < INT32_MAX; seed++) {
+            unsigned int j;
+            for (j = 0; j < bucket->size; j++) {
+                unsigned int slot = bundle_hash(resources[members[j]].path, (uint32_t)seed) % count;
+                if (taken[slot])
+                    break;
+                taken[slot] = true;
+                slots[members[j]] = slot;
+            }
+            if (j == bucket->size)
+                break;
+            while (j > 0)
+                taken[slots[members[--j]]] = false;     /* undo, try the next seed */
+        }
+        if (seed == INT32_MAX)
+            fatal("Failed to build the directory of the bundle.");
+        displace[bucket->index] = seed;
+    }
+    free(buckets);
+    free(keys);
+    free(hashes);
+    free(taken);
+}
+
+/* The declarations that all bundles share, emitted once per output file. */
+static const char bundle_helper[] =
+    "#ifndef BIN2C_RESOURCE_DEFINED\n"
+    "#define BIN2C_RESOURCE_DEFINED\n"
+    "#include <string.h>\n"
+    "typedef struct bin2c_resource {\n"
+    "    const char *path;\n"
+    "    unsigned int offset;            /* position in the bundle */\n"
+    "    unsigned int size;              /* size in the bundle */\n"
+    "    unsigned int size_uncompressed;\n"
+    "    unsigned int codec;\n"
+    "} bin2c_resource;\n"
+    "/* bin2c_hash() is the hash function for the directory of a bundle */\n"
+    "static inline uint32_t bin2c_hash(const char *key, uint32_t seed)\n"
+    "{\n"
+    "    uint32_t h = 2166136261u ^ seed;\n"
+    "    while (*key != '\\0')\n"
+    "        h = (h ^ (uint8_t)*key++) * 16777619u;\n"
+    "    h ^= h >> 16;\n"
+    "    h *= 0x7feb352du;\n"
+    "    h ^= h >> 15;\n"
+    "    h *= 0x846ca68bu;\n"
+    "    h ^= h >> 16;\n"
+    "    return h;\n"
+    "}\n"
+    "#endif\n";
+
+/* convert_bundle() packs the input files of all entries in a single array, and
+   appends the directory and the lookup function; with "dedup" set, files with
+   the same contents are stored only once */
+static void convert_bundle(const ENTRYLIST *list, const OPTIONS *opts, const char *f_outputname,
+                           OUTPUT *output, bool dedup)
+{
+    const unsigned int bitsize = opts->bitsize;
+    if (opts->format != FORMAT_ARRAY)
+        fatal("A bundle requires the 'array' format.");
+    char *symbolname = make_symbolname(opts->label, f_outputname);
+    RESOURCE *resources = malloc(list->count * sizeof(RESOURCE));
+    if (resources == NULL)
+        fatal("Memory allocation error.");
+
+    emit_codecs(output);
+    if ((output->emitted & EMITTED_BUNDLE) == 0) {
+        output_printf(output, "\n\n");
+        output_write(output, bundle_helper, strlen(bundle_helper));
+        output->emitted |= EMITTED_BUNDLE;
+    }
+    output_printf(output, "\n");
+    output_declspec(output, opts);
+    output_printf(output, "uint%u_t %s[] = {", bitsize, symbolname);
+    EMITTER emitter;
+    emit_init(&emitter, output, FORMAT_ARRAY, bitsize, opts->big_endian, opts->jobs);
+    uint64_t position = 0;
+    for (unsigned int idx = 0; idx < list->count; idx++) {
+        const ENTRY *entry = &list->entries[idx];
+        const OPTIONS *entry_opts = &entry->opts;
+        if (entry_opts->block_size > 0)
+            fatal("Option --blocksize is not supported in a bundle.");
+        if (entry_opts->split_size > 0 || entry_opts->shards > 0)
+            fatal("Options --split and --shards are not supported in a bundle.");
+        if (entry_opts->accessor || entry_opts->sparse || entry_opts->base != NULL || entry_opts->cpp)
+            fatal("Options --accessor, --base, --cpp and --sparse are not supported in a bundle.");
+        RESOURCE *res = &resources[idx];
+        const char *path = entry->inputname;
+        while (path[0] == '.' && (path[1] == '/' || path[1] == '\\'))
+            path += 2;
+        res->path = strdup(path);
+        if (res->path == NULL)
+            fatal("Memory allocation error.");
+        for (char *ptr = res->path; *ptr != '\0'; ptr++)
+            if (*ptr == '\\')
+                *ptr = '/';
+        res->inputname = entry->inputname;
+        if (dedup) {
+            /* a duplicate refers to the data of the first file */
+            res->key = content_key(entry->inputname, entry_opts);
+            unsigned int prev = 0;
+            while (prev < idx && (resources[prev].key != res->key
+                                  || !same_contents(resources[prev].inputname, entry->inputname)))
+                prev++;
+            if (prev < idx) {
+                res->offset = resources[prev].offset;
+                res->size = resources[prev].size;
+                res->size_uncompressed = resources[prev].size_uncompressed;
+                res->codec = resources[prev].codec;
+                continue;
+            }
+        }
+
+        /* start each file at an aligned position */
+        static const uint8_t zeros[BUNDLE_ALIGN];
+        unsigned int padding = (unsigned int)(-position & (BUNDLE_ALIGN - 1));
+        if (padding > 0)
+            emit_data(&emitter, zeros, padding);
+        position += padding;
+        res->offset = position;
+
+        int level = 0;
+        const CODEC *codec = select_codec(entry_opts, &level);
+        INPUT input;
+        uint64_t file_size = open_input(&input, entry->inputname, entry_opts);
+        stats.files++;
+        uint64_t data_size = entry_opts->zero_terminate ? file_size - 1 : file_size;
+        if (position + file_size > UINT_MAX)
+            fatal("The bundle is too large.");
+        res->codec = entry_opts->codec;
+        res->size_uncompressed = (unsigned int)file_size;
+        uint64_t count = 0;
+        if (codec != NULL) {
+            STREAM stream;
+            stream_open(&stream, codec, level, file_size, 0, 1, &emitter);
+            copy_input(&input, &emitter, &stream, &count, file_size, data_size);
+            stream_write(&stream, NULL, 0, true);
+            stream_close(&stream);
+            if (position + stream.total > UINT_MAX)
+                fatal("The bundle is too large.");
+            res->size = (unsigned int)stream.total;
+        } else {
+            copy_input(&input, &emitter, NULL, &count, file_size, data_size);
+            res->size = (unsigned int)file_size;
+        }
+        input_close(&input);
+        position += res->size;
+    }
+    emit_finish(&emitter);
+    uint64_t array_size = (position + ((bitsize >> 3) - 1)) / (bitsize >> 3);
+    output_printf(output, "\n};\n\n");
+    output_size(output, opts, symbolname, "_size", array_size, opts->use_macro, false);
+
+    /* the directory, in the order of the slots of the perfect hash */
+    unsigned int count = list->count;
+    int32_t *displace = malloc(count * sizeof(int32_t));
+    unsigned int *slots = malloc(count * sizeof(unsigned int));
+    unsigned int *order = malloc(count * sizeof(unsigned int));
+    if (displace == NULL || slots == NULL || order == NULL)
+        fatal("Memory allocation error.");
+    build_phf(resources, count, displace, slots);
+    for (unsigned int idx = 0; idx < count; idx++)
+        order[slots[idx]] = idx;
+    output_printf(output, "const bin2c_resource %s_directory[%u] = {\n", symbolname, count);
+    for (unsigned int idx = 0; idx < count; idx++) {
+        const RESOURCE *res = &resources[order[idx]];
+        output_printf(output, "\t{ ");
+        output_cstring(output, res->path);
+        output_printf(output, ", %u, %u, %u, %s }%s\n", (unsigned int)res->offset, res->size,
+                      res->size_uncompressed, codecs[res->codec].macro, (idx + 1 < count) ? "," : "");
+    }
+    output_printf(output, "};\n");
+    output_printf(output, "const int %s_displace[%u] = {", symbolname, count);
+    for (unsigned int idx = 0; idx < count; idx++)
+        output_printf(output, "%s%" PRId32, (idx == 0) ? "\n\t" : (idx % 8 == 0) ? ",\n\t" : ", ",
+                      displace[idx]);
+    output_printf(output, "\n};\n");
+    if (opts->use_macro)
+        output_printf(output, "#define %s_count %u\n", symbolname, count);
+    else
+        output_printf(output, "const unsigned int %s_count = %u;\n", symbolname, count);
+    output_printf(output, "/* %s_find() returns the file with the path, or NULL if it is not in the bundle */\n"
+                          "static inline const bin2c_resource *%s_find(const char *path)\n"
+                          "{\n"
+                          "    int d = %s_displace[bin2c_hash(path, 0) %% %uu];\n"
+                          "    unsigned int slot = (d < 0) ? (unsigned int)(-d - 1) : bin2c_hash(path, (uint32_t)d) %% %uu;\n"
+                          "    return (strcmp(%s_directory[slot].path, path) == 0) ? &%s_directory[slot] : 0;\n"
+                          "}\n",
+                  symbolname, symbolname, symbolname, count, count, symbolname, symbolname);
+
+    for (unsigned int idx = 0; idx < count; idx++)
+        free(resources[idx].path);
+    free(resources);
+    free(displace);
+    free(slots);
+    free(order);
+    free(symbolname);
+}
+
+/* convert_alias() declares the symbols for an input file with the same contents
+   (and options) as an earlier input file, as aliases for the symbols of that
+   earlier file */
+static void convert_alias(const OPTIONS *opts, const char *f_inputname, const char *original,
+                          OUTPUT *output)
+{
+    static const char *suffixes[] = { "", "_size", "_size_uncompressed", "_codec", "_block_size", "_index" };
+    unsigned int count = 2;
+    if (opts->codec != CODEC_NONE)
+        count = (opts->block_size > 0) ? 6 : 4;
+    char *symbolname = make_symbolname(opts->label, f_inputname);
+    output_printf(output, "\n\n/* %s has the same contents as %s */\n", symbolname, original);
+    for (unsigned int idx = 0; idx < count; idx++)
+        output_printf(output, "#define %s%s %s%s\n", symbolname, suffixes[idx], original, suffixes[idx]);
+    if (opts->cpp)
+        output_printf(output, "#define %s_span %s_span\n", symbolname, original);
+    if (opts->base != NULL) {
+        output_printf(output, "#define %s_size_patched %s_size_patched\n", symbolname, original);
+        output_printf(output, "#define %s_size_base %s_size_base\n", symbolname, original);
+        if (opts->codec == CODEC_NONE)
+            output_printf(output, "#define %s_patch %s_patch\n", symbolname, original);
+    }
+    if (opts->accessor) {
+        output_printf(output, "#define %s_data %s_data\n", symbolname, original);
+        output_printf(output, "#define %s_open %s_open\n", symbolname, original);
+        if (opts->codec != CODEC_NONE && opts->block_size > 0)
+            output_printf(output, "#define %s_pager %s_pager\n", symbolname, original);
+    }
+    if (opts->split_size > 0 || opts->shards > 0) {
+        static const char *part_suffixes[] = { "_parts", "_part_size", "_part_count" };
+        for (unsigned int idx = 0; idx < sizeof part_suffixes / sizeof part_suffixes[0]; idx++)
+            output_printf(output, "#define %s%s %s%s\n", symbolname, part_suffixes[idx], original,
+                          part_suffixes[idx]);
+    }
+    free(symbolname);
+}
+
+/* A list of the files that were created in this run; when a file is written to
+   a second time, it is appended to (instead of overwritten). */
+typedef struct tagNAMELIST {
+    char **names;
+    unsigned int count;
+} NAMELIST;
+
+static bool in_namelist(const NAMELIST *list, const char *name)
+{
+    for (unsigned int idx = 0; idx < list->count; idx++)
+        if (strcmp(list->names[idx], name) == 0)
+            return true;
+    return false;
+}
+
+static void add_namelist(NAMELIST *list, const char *name)
+{
+    if (in_namelist(list, name))
+        return;
+    list->names = realloc(list->names, (list->count + 1) * sizeof(char *));
+    if (list->names == NULL || (list->names[list->count] = strdup(name)) == NULL)
+        fatal("Memory allocation error.");
+    list->count++;
+}
+
+static void free_namelist(NAMELIST *list)
+{
+    for (unsigned int idx = 0; idx < list->count; idx++)
+        free(list->names[idx]);
+    free(list->names);
+    list->names = NULL;
+    list->count = 0;
+}
+
+/* hash_entry() adds the options and the contents of the input file of an entry
+   to the hash */
+static void hash_entry(HASH *hash, const ENTRY *entry)
+{
+    const OPTIONS *opts = &entry->opts;
+    hash_options(hash, opts);
+    const char *label = (opts->label != NULL) ? opts->label : "$*";
+    hash_update(hash, label, strlen(label) + 1);
+    hash_update(hash, entry->inputname, strlen(entry->inputname) + 1);
+    hash_file(hash, entry->inputname);
+}
+
+/* the version of the generated code, which is part of the hash for --update,
+   so that output files are regenerated when the generated code changes (raise
+   it with each such change) */
+#define GENERATOR_VERSION 1
+
+/* read_hash() reads the hash from the banner of an existing output file; it
+   returns false if the file does not exist or has no hash */
+static bool read_hash(const char *outputname, uint64_t *value)
+{
+    FILE *fp = fopen(outputname, "rt");
+    if (fp == NULL)
+        return false;
+    char line[128];
+    bool result = fgets(line, sizeof line, fp) != NULL
+                  && sscanf(line, "/* generated by Bin2C, hash %" SCNx64 " */", value) == 1;
+    fclose(fp);
+    return result;
+}
+
+/* read_data_hash() returns whether the file notes the hash for the data file
+   of a symbol, see output_data_hash() (a long line may be read in pieces, and
+   a note that is cut in two is then missed) */
+static bool read_data_hash(const char *filename, const char *symbolname, uint64_t value)
+{
+    FILE *fp = fopen(filename, "rt");
+    if (fp == NULL)
+        return false;
+    char line[512];
+    size_t length = strlen(symbolname);
+    bool found = false;
+    while (!found && fgets(line, sizeof line, fp) != NULL) {
+        const char *ptr = line;
+        while (!found && (ptr = strstr(ptr, "/* data of ")) != NULL) {
+            ptr += 11;
+            uint64_t stored;
+            found = strncmp(ptr, symbolname, length) == 0
+                    && sscanf(ptr + length, ", hash %" SCNx64 " */", &stored) == 1 && stored == value;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+/* companions_current() returns whether the files that go with the output file
+   for an entry (the assembler file, the shards and the data file) exist, and
+   belong to the same hash; the data file is checked on the hash of its
+   contents */
+static bool companions_current(const ENTRY *entry, const char *outputname, uint64_t value)
+{
+    const OPTIONS *opts = &entry->opts;
+    uint64_t stored;
+    char *asmname = replace_extension(outputname, ".S");
+    bool current = (opts->format != FORMAT_INCBIN) || (read_hash(asmname, &stored) && stored == value);
+    char *symbolname = make_symbolname(opts->label, entry->inputname);
+    for (unsigned int shard = 0; current && shard < opts->shards; shard++) {
+        char suffix[32];
+        sprintf(suffix, "_%u.c", shard);
+        char *name = data_filename(outputname, symbolname, suffix);
+        current = read_hash(name, &stored) && stored == value;
+        free(name);
+    }
+    if (current && uses_blob(opts)) {
+        char *blobname = data_filename(outputname, symbolname, ".blob");
+        FILE *fp = fopen(blobname, "rb");
+        current = (fp != NULL);
+        if (fp != NULL) {
+            fclose(fp);
+            HASH hash;
+            hash_init(&hash);
+            hash_file(&hash, blobname);
+            current = read_data_hash((opts->format == FORMAT_INCBIN) ? asmname : outputname, symbolname,
+                                     hash_final(&hash));
+        }
+        free(blobname);
+    }
+    free(symbolname);
+    free(asmname);
+    return current;
+}
+
+/* run() handles a command line (from main(), or from a request in worker
+   mode); it returns the exit code */
+static int run(int argc, char *argv[])
+{
+    OPTIONS options;
+    init_options(&options);
+    direct_output = false;
+    has_banner_hash = false;
+    stats.enabled = 0;
+    bool is_appending = false;
+    bool check_update = false;
+    bool is_bundle = false;
+    bool dedup = false;
+
+    /* parse command line */
+    if (argc <= 1)
+        about(NULL);
+    const char **args = malloc(argc * sizeof(char *));  /* file arguments */
+    if (args == NULL)
+        fatal("Memory allocation error.");
+    int argcount = 0;
+    bool has_listfile = false;
+    for (int idx = 1; idx < argc; idx++) {
+        if (argv[idx][0] == '-' && argv[idx][1] != '\0') {    /* "-" is standard input or output */
+            if (strcmp(argv[idx], "-a") == 0 || strcmp(argv[idx], "--append") == 0)
+                is_appending = true;
+            else if (strcmp(argv[idx], "-u") == 0 || strcmp(argv[idx], "--update") == 0)
+                check_update = true;
+            else if (strcmp(argv[idx], "--bundle") == 0)
+                is_bundle = true;
+            else if (strcmp(argv[idx], "--dedup") == 0)
+                dedup = true;
+            else if (strcmp(argv[idx], "--direct") == 0)
+                direct_output = true;
+            else if (strcmp(argv[idx], "--stats") == 0)
+                stats_start(1);
+            else if (strcmp(argv[idx], "--stats-json") == 0)
+                stats_start(2);
+            else if (strcmp(argv[idx], "-h") == 0 || strcmp(argv[idx], "--help") == 0 || strcmp(argv[idx], "-?") == 0)
+                about(NULL);
+            else
+                parse_option(&options, argc, argv, &idx);   /* unknown options are ignored */
+        } else {
+            args[argcount++] = argv[idx];
+            if (argv[idx][0] == '@')
+                has_listfile = true;
+        }
+    }
+
+    /* collect the input files; the options on the command line apply to all of
+       them (so list files are only read after all options are parsed); without
+       -o and without list files, the traditional syntax applies: an input file
+       with an optional output file */
+    ENTRYLIST list = { NULL, 0, 0 };
+    if (is_bundle && options.outputname == NULL)
+        fatal("The option --bundle requires an output file (option -o).");
+    if (options.outputname == NULL && !has_listfile && argcount == 2) {
+        ENTRY *entry = add_entry(&list, args[0], &options);
+        entry->opts.outputname = args[1];
+    } else if (options.outputname == NULL && !has_listfile && argcount > 2) {
+        fatal("Too many filenames. Use 'bin2c --help' for usage information.");
+    } else {
+        for (int idx = 0; idx < argcount; idx++) {
+            if (args[idx][0] == '@')
+                read_listfile(&list, args[idx] + 1, &options);
+            else
+                add_entry(&list, args[idx], &options);
+        }
+    }
+    free(args);
+    /* directories are added to a bundle with all files in them; the original
+       list is kept, because the entries may refer to its storage */
+    ENTRYLIST sources = { NULL, 0, 0 };
+    if (is_bundle) {
+        sources = list;
+        list.entries = NULL;
+        list.count = list.size = 0;
+        for (unsigned int idx = 0; idx < sources.count; idx++) {
+            const ENTRY *entry = &sources.entries[idx];
+            if (is_directory(entry->inputname))
+                add_directory(&list, entry->inputname, &entry->opts);
+            else
+                add_entry(&list, entry->inputname, &entry->opts);
+        }
+    }
+    if (list.count == 0)
+        fatal("No input file. Use 'bin2c --help' for usage information.");
+    if (is_appending && check_update)
+        fatal("The options --append and --update cannot be combined.");
+
+    /* set the output file for each entry */
+    char **outputnames = malloc(list.count * sizeof(char *));
+    if (outputnames == NULL)
+        fatal("Memory allocation error.");
+    for (unsigned int idx = 0; idx < list.count; idx++) {
+        ENTRY *entry = &list.entries[idx];
+        if (is_bundle)
+            outputnames[idx] = strdup(options.outputname);
+        else if (entry->opts.outputname != NULL)
+            outputnames[idx] = strdup(entry->opts.outputname);
+        else if (strcmp(entry->inputname, "-") == 0)
+            outputnames[idx] = strdup("-");
+        else
+            outputnames[idx] = default_outputname(entry->inputname);
+        if (outputnames[idx] == NULL)
+            fatal("Memory allocation error.");
+    }
+
+    /* standard input can only be read once, and some options need a file name
+       for the output (or write files next to it) */
+    if (is_bundle && strcmp(options.outputname, "-") == 0 && options.label == NULL)
+        fatal("Writing a bundle to standard output requires a symbol name (option --label).");
+    unsigned int stdin_count = 0;
+    for (unsigned int idx = 0; idx < list.count; idx++) {
+        const ENTRY *entry = &list.entries[idx];
+        if (in_request() && (strcmp(entry->inputname, "-") == 0 || strcmp(outputnames[idx], "-") == 0))
+            fatal("Standard input and output cannot be used in worker mode.");
+        if (strcmp(entry->inputname, "-") == 0) {
+            if (++stdin_count > 1)
+                fatal("Standard input can only be read once.");
+            if (entry->opts.label == NULL)
+                fatal("Reading from standard input requires a symbol name (option --label).");
+            if (check_update || dedup || is_bundle)
+                fatal("Standard input cannot be used with --update, --dedup or --bundle.");
+        }
+        if (strcmp(outputnames[idx], "-") == 0
+            && (check_update || entry->opts.format == FORMAT_INCBIN || entry->opts.shards > 0))
+            fatal("Standard output cannot be used with --update, --shards or the 'incbin' format.");
+    }
+
+    /* for the update check, a single hash covers all entries for an output file;
+       an output file is skipped if the hash in its banner is the same */
+    uint64_t *hashes = NULL;
+    bool *uptodate = NULL;
+    if (check_update) {
+        hashes = malloc(list.count * sizeof(uint64_t));
+        uptodate = malloc(list.count * sizeof(bool));
+        if (hashes == NULL || uptodate == NULL)
+            fatal("Memory allocation error.");
+        for (unsigned int idx = 0; idx < list.count; idx++) {
+            unsigned int first = 0;
+            while (strcmp(outputnames[first], outputnames[idx]) != 0)
+                first++;
+            if (first < idx)
+                continue;   /* this output file was already handled */
+            HASH hash;
+            hash_init(&hash);
+            const uint32_t version = GENERATOR_VERSION;
+            hash_update(&hash, &version, sizeof version);
+            if (is_bundle)
+                hash_update(&hash, "--bundle", 8);
+            if (dedup)
+                hash_update(&hash, "--dedup", 7);
+            for (unsigned int j = idx; j < list.count; j++)
+                if (strcmp(outputnames[j], outputnames[idx]) == 0)
+                    hash_entry(&hash, &list.entries[j]);
+            uint64_t value = hash_final(&hash);
+            uint64_t stored;
+            bool same = read_hash(outputnames[idx], &stored) && stored == value;
+            for (unsigned int j = idx; same && j < list.count; j++)
+                if (strcmp(outputnames[j], outputnames[idx]) == 0)
+                    same = companions_current(&list.entries[j], outputnames[idx], value);
+            for (unsigned int j = idx; j < list.count; j++) {
+                if (strcmp(outputnames[j], outputnames[idx]) == 0) {
+                    hashes[j] = value;
+                    uptodate[j] = same;
+                }
+            }
+        }
+    }
+
+    /* for detecting duplicates, the keys of the entries, and whether each entry
+       was converted (rather than written as an alias) */
+    uint64_t *keys = NULL;
+    bool *is_original = NULL;
+    if (dedup && !is_bundle) {
+        keys = malloc(list.count * sizeof(uint64_t));
+        is_original = calloc(list.count, sizeof(bool));
+        if (keys == NULL || is_original == NULL)
+            fatal("Memory allocation error.");
+    }
+
+    /* convert all entries; consecutive entries for the same output file share
+       the open file, and all entries share the output buffer */
+    OUTPUT output;
+    output_init(&output, NULL);
+    char *f_outputname = NULL;  /* name of the output file that is currently open */
+    NAMELIST written = { NULL, 0 };
+    for (unsigned int idx = 0; idx < list.count; idx++) {
+        ENTRY *entry = &list.entries[idx];
+        if (uptodate != NULL && uptodate[idx])
+            continue;
+        if (f_outputname == NULL || strcmp(f_outputname, outputnames[idx]) != 0) {
+            if (f_outputname != NULL)
+                output_done(&output);
+            f_outputname = outputnames[idx];
+            bool append = is_appending || in_namelist(&written, f_outputname);
+            output_open(&output, f_outputname, append);
+            has_banner_hash = (hashes != NULL);
+            if (hashes != NULL)
+                banner_hash = hashes[idx];
+            if (!append) {
+                output_banner(&output);
+                output_printf(&output, "#include <stdint.h>");
+            }
+            add_namelist(&written, f_outputname);
+        }
+        if (is_bundle) {
+            convert_bundle(&list, &options, f_outputname, &output, dedup);
+            break;
+        }
+        if (keys != NULL && !entry->opts.is_mutable) {
+            /* a file with the same contents as an earlier file in the same output
+               file becomes an alias (but not for mutable arrays, as these must
+               stay separate) */
+            keys[idx] = content_key(entry->inputname, &entry->opts);
+            unsigned int prev = 0;
+            while (prev < idx && (!is_original[prev] || keys[prev] != keys[idx]
+                                  || strcmp(outputnames[prev], f_outputname) != 0
+                                  || !same_contents(list.entries[prev].inputname, entry->inputname)))
+                prev++;
+            if (prev < idx) {
+                const ENTRY *original = &list.entries[prev];
+                char *symbolname = make_symbolname(original->opts.label, original->inputname);
+                convert_alias(&entry->opts, entry->inputname, symbolname, &output);
+                free(symbolname);
+                continue;
+            }
+            is_original[idx] = true;
+        }
+        char *asmname = replace_extension(f_outputname, ".S");
+        bool append_asm = is_appending || in_namelist(&written, asmname);
+        if (entry->opts.format == FORMAT_INCBIN)
+            add_namelist(&written, asmname);
+        free(asmname);
+        convert(&entry->opts, entry->inputname, f_outputname, &output, append_asm);
+    }
+    if (f_outputname != NULL)
+        output_done(&output);
+    output_close(&output);
+    for (unsigned int idx = 0; idx < list.count; idx++)
+        free(outputnames[idx]);
+    free(outputnames);
+    free(hashes);
+    free(uptodate);
+    free(keys);
+    free(is_original);
+    free_namelist(&written);
+    free_entries(&list);
+    free_entries(&sources);
+
+    if (stats.enabled)
+        stats_report();
+    return 0;
+}
+
+/* Worker mode (option --worker): Bin2C stays running, and it reads requests
+   from standard input, one JSON object per line, in the format of the JSON
+   worker protocol of Bazel:
+     {"arguments": ["logo.png", "logo.h", "--label", "logo"], "requestId": 1}
+   The arguments are the same as on the command line. Requests are handled on
+   a pool of threads; for each request, a line with the result is written on
+   standard output:
+     {"exitCode": 0, "output": "", "requestId": 1}
+   The results are written when the requests complete, which need not be in
+   the order of the requests. Other fields of a request are ignored. */
+typedef struct tagREQUEST {
+    struct tagREQUEST *next;
+    char *line;                 /* the JSON text, decoded in place */
+    char **argv;                /* arguments, with the program name in argv[0] */
+    int argc;
+    long long id;
+} REQUEST;
+
+typedef struct tagWORKER {
+    MONITOR monitor;            /* protects the queue and standard output */
+    REQUEST *head, *tail;
+    bool closed;                /* end of standard input */
+} WORKER;
+
+static char *json_space(char *ptr)
+{
+    while (*ptr == ' ' || *ptr == '\t' || *ptr == '\r' || *ptr == '\n')
+        ptr++;
+    return ptr;
+}
+
+/* json_string() decodes the string that starts at "ptr" (at the opening quote)
+   in place (the decoded string is never longer than the JSON text), and sets
+   "text" to the decoded string; it returns the position behind the string, or
+   NULL on a syntax error */
+static char *json_string(char *ptr, char **text)
+{
+    if (*ptr != '"')
+        return NULL;
+    char *dest = ptr++;
+    *text = dest;
+    while (*ptr != '"') {
+        if ((unsigned char)*ptr < 0x20)
+            return NULL;    /* control characters (and the end of the line) */
+        if (*ptr != '\\') {
+            *dest++ = *ptr++;
+            continue;
+        }
+        ptr++;
+        switch (*ptr++) {
+        case '"':  *dest++ = '"';  break;
+        case '\\': *dest++ = '\\'; break;
+        case '/':  *dest++ = '/';  break;
+        case 'b':  *dest++ = '\b'; break;
+        case 'f':  *dest++ = '\f'; break;
+        case 'n':  *dest++ = '\n'; break;
+        case 'r':  *dest++ = '\r'; break;
+        case 't':  *dest++ = '\t'; break;
+        case 'u': {
+            char digits[5] = { 0 }, *end;
+            strncpy(digits, ptr, 4);
+            unsigned long code = strtoul(digits, &end, 16);
+            if (end != digits + 4)
+                return NULL;
+            ptr += 4;
+            if (code >= 0xd800 && code < 0xdc00 && ptr[0] == '\\' && ptr[1] == 'u') {
+                /* surrogate pair */
+                strncpy(digits, ptr + 2, 4);
+                unsigned long low = strtoul(digits, &end, 16);
+                if (end == digits + 4 && low >= 0xdc00 && low < 0xe000) {
+                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                    ptr += 6;
+                }
+            }
+            if (code < 0x80) {
+                *dest++ = (char)code;
+            } else if (code < 0x800) {
+                *dest++ = (char)(0xc0 | (code >> 6));
+                *dest++ = (char)(0x80 | (code & 0x3f));
+            } else if (code < 0x10000) {
+                *dest++ = (char)(0xe0 | (code >> 12));
+                *dest++ = (char)(0x80 | ((code >> 6) & 0x3f));
+                *dest++ = (char)(0x80 | (code & 0x3f));
+            } else {
+                *dest++ = (char)(0xf0 | (code >> 18));
+                *dest++ = (char)(0x80 | ((code >> 12) & 0x3f));
+                *dest++ = (char)(0x80 | ((code >> 6) & 0x3f));
+                *dest++ = (char)(0x80 | (code & 0x3f));
+            }
+            break;
+        }
+        default:
+            return NULL;
+        }
+    }
+    *dest = '\0';
+    return ptr + 1;
+}
+
+/* json_skip() skips a value of any type; it returns the position behind the
+   value, or NULL on a syntax error */
+static char *json_skip(char *ptr, int depth)
+{
+    char *text;
+    if (*ptr == '"')
+        return json_string(ptr, &text);
+    if (*ptr == '{' || *ptr == '[') {
+        char close = (*ptr == '{') ? '}' : ']';
+        if (depth >= 32)
+            return NULL;
+        ptr = json_space(ptr + 1);
+        if (*ptr == close)
+            return ptr + 1;
+        for ( ;; ) {
+            if (close == '}') {
+                if ((ptr = json_string(ptr, &text)) == NULL)
+                    return NULL;
+                ptr = json_space(ptr);
+                if (*ptr != ':')
+                    return NULL;
+                ptr = json_space(ptr + 1);
+            }
+            if ((ptr = json_skip(ptr, depth + 1)) == NULL)
+                return NULL;
+            ptr = json_space(ptr);
+            if (*ptr == close)
+                return ptr + 1;
+            if (*ptr != ',')
+                return NULL;
+            ptr = json_space(ptr + 1);
+        }
+    }
+    /* a number, or true, false or null */
+    char *start = ptr;
+    while (isalnum((unsigned char)*ptr) || *ptr == '-' || *ptr == '+' || *ptr == '.')
+        ptr++;
+    return (ptr > start) ? ptr : NULL;
+}
+
+static void add_argument(REQUEST *request, char *arg)
+{
+    char **argv = realloc(request->argv, (request->argc + 2) * sizeof(char *));
+    if (argv == NULL)
+        fatal("Memory allocation error.");
+    argv[request->argc++] = arg;
+    argv[request->argc] = NULL;
+    request->argv = argv;
+}
+
+/* parse_request() collects the arguments and the identifier of a request; it
+   returns false on a syntax error */
+static bool parse_request(REQUEST *request)
+{
+    static char program[] = "bin2c";
+    add_argument(request, program);
+    char *ptr = json_space(request->line);
+    if (*ptr != '{')
+        return false;
+    ptr = json_space(ptr + 1);
+    if (*ptr == '}')
+        return true;
+    for ( ;; ) {
+        char *key;
+        if ((ptr = json_string(ptr, &key)) == NULL)
+            return false;
+        ptr = json_space(ptr);
+        if (*ptr != ':')
+            return false;
+        ptr = json_space(ptr + 1);
+        if (strcmp(key, "arguments") == 0) {
+            if (*ptr != '[')
+                return false;
+            ptr = json_space(ptr + 1);
+            while (*ptr != ']') {
+                char *arg;
+                if ((ptr = json_string(ptr, &arg)) == NULL)
+                    return false;
+                add_argument(request, arg);
+                ptr = json_space(ptr);
+                if (*ptr == ',')
+                    ptr = json_space(ptr + 1);
+                else if (*ptr != ']')
+                    return false;
+            }
+            ptr++;
+        } else if (strcmp(key, "requestId") == 0) {
+            char *end;
+            request->id = strtoll(ptr, &end, 10);
+            if (end == ptr)
+                return false;
+            ptr = end;
+        } else if ((ptr = json_skip(ptr, 0)) == NULL) {
+            return false;
+        }
+        ptr = json_space(ptr);
+        if (*ptr == '}')
+            return true;
+        if (*ptr != ',')
+            return false;
+        ptr = json_space(ptr + 1);
+    }
+}
+
+/* handle_request() runs a request and writes the response; fatal() jumps back
+   here, also for an error in a compression job (which the thread of the
+   request raises again after it joined the jobs). Before the jump, fatal()
+   closes the inputs and outputs of the request; its temporary files are then
+   removed here. Other memory that a failed request allocated may be lost. */
+static void handle_request(WORKER *worker, REQUEST *request)
+{
+    FAILURE fail;
+    fail.message[0] = '\0';
+    fail.worker = true;
+    volatile int code = 1;
+    failure = &fail;
+    if (setjmp(fail.env) == 0) {
+        if (parse_request(request))
+            code = run(request->argc, request->argv);
+        else
+            strcpy(fail.message, "Invalid request.");
+    } else {
+        remove_temp_files();
+    }
+    failure = NULL;
+
+    monitor_enter(&worker->monitor);
+    printf("{\"exitCode\":%d,\"output\":\"", code);
+    if (fail.message[0] != '\0')
+        printf("ERROR: ");
+    for (const char *ptr = fail.message; *ptr != '\0'; ptr++) {
+        if (*ptr == '"' || *ptr == '\\')
+            printf("\\%c", *ptr);
+        else if ((unsigned char)*ptr < 0x20)
+            printf("\\u%04x", *ptr);
+        else
+            putchar(*ptr);
+    }
+    printf("%s\",\"requestId\":%lld}\n", (fail.message[0] != '\0') ? "\\n" : "", request->id);
+    fflush(stdout);
+    monitor_leave(&worker->monitor);
+}
+
+/* release_warm() frees the buffers and contexts that a thread kept */
+static void release_warm(void)
+{
+    free(warm_output);
+    warm_output = NULL;
+#ifdef USE_ZLIB
+    if (warm_context[CODEC_DEFLATE] != NULL) {
+        deflateEnd(warm_context[CODEC_DEFLATE]);
+        free(warm_context[CODEC_DEFLATE]);
+    }
+#endif
+#ifdef USE_LZ4
+    if (warm_context[CODEC_LZ4] != NULL)
+        LZ4F_freeCompressionContext(warm_context[CODEC_LZ4]);
+#endif
+#ifdef USE_ZSTD
+    if (warm_context[CODEC_ZSTD] != NULL)
+        ZSTD_freeCCtx(warm_context[CODEC_ZSTD]);
+#endif
+}
+
+THREAD_FUNC(worker_thread)
+{
+    WORKER *worker = (WORKER *)arg;
+    for ( ;; ) {
+        monitor_enter(&worker->monitor);
+        while (worker->head == NULL && !worker->closed)
+            monitor_wait(&worker->monitor);
+        REQUEST *request = worker->head;
+        if (request != NULL) {
+            worker->head = request->next;
+            if (worker->head == NULL)
+                worker->tail = NULL;
+        }
+        monitor_leave(&worker->monitor);
+        if (request == NULL)
+            break;  /* no more requests */
+        handle_request(worker, request);
+        free(request->argv);
+        free(request->line);
+        free(request);
+    }
+    release_warm();
+    THREAD_RETURN;
+}
+
+/* run_worker() reads requests until the end of standard input, and hands
+   them to "threads" threads (0 is for one thread per CPU core) */
+static int run_worker(unsigned int threads)
+{
+#if defined _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    if (threads == 0)
+        threads = cpu_count();
+    if (threads > MAX_JOBS)
+        threads = MAX_JOBS;
+    WORKER worker;
+    monitor_init(&worker.monitor);
+    worker.head = worker.tail = NULL;
+    worker.closed = false;
+    THREAD pool[MAX_JOBS];
+    unsigned int count = 0;
+    while (count < threads && thread_start(&pool[count], worker_thread, &worker))
+        count++;
+    if (count == 0)
+        fatal("Failed to start the worker threads.");
+
+    size_t capacity = 256, length = 0;
+    char *line = malloc(capacity);
+    if (line == NULL)
+        fatal("Memory allocation error.");
+    for ( ;; ) {
+        bool eof = (fgets(line + length, (int)(capacity - length), stdin) == NULL);
+        if (!eof)
+            length += strlen(line + length);
+        line[length] = '\0';   /* fgets() leaves the buffer as is at the end of the input */
+        if (!eof && (length == 0 || line[length - 1] != '\n')) {
+            if (length + 1 == capacity) {
+                capacity *= 2;
+                char *buffer = realloc(line, capacity);
+                if (buffer == NULL)
+                    fatal("Memory allocation error.");
+                line = buffer;
+            }
+            continue;   /* read the rest of the line */
+        }
+        if (*json_space(line) != '\0' || (length > 0 && !eof)) {
+            REQUEST *request = calloc(1, sizeof(REQUEST));
+            if (request == NULL)
+                fatal("Memory allocation error.");
+            request->line = line;
+            monitor_enter(&worker.monitor);
+            if (worker.tail != NULL)
+                worker.tail->next = request;
+            else
+                worker.head = request;
+            worker.tail = request;
+            monitor_notify(&worker.monitor, false);
+            monitor_leave(&worker.monitor);
+            capacity = 256;
+            line = malloc(capacity);
+            if (line == NULL)
+                fatal("Memory allocation error.");
+        }
+        length = 0;
+        if (eof)
+            break;
+    }
+    free(line);
+
+    monitor_enter(&worker.monitor);
+    worker.closed = true;
+    monitor_notify(&worker.monitor, true);
+    monitor_leave(&worker.monitor);
+    for (unsigned int idx = 0; idx < count; idx++)
+        thread_join(pool[idx]);
+    monitor_destroy(&worker.monitor);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    init_hextables();
+    atexit(remove_temp_files);
+    bool worker = false;
+    for (int idx = 1; idx < argc; idx++)
+        if (strcmp(argv[idx], "--worker") == 0 || strcmp(argv[idx], "--persistent_worker") == 0)
+            worker = true;
+    if (!worker)
+        return run(argc, argv);
+    /* in worker mode, option -j sets the number of threads that run requests
+       (the default is one thread per CPU core) */
+    unsigned int threads = 0;
+    for (int idx = 1; idx < argc; idx++)
+        if (strncmp(argv[idx], "-j", 2) == 0 || strncmp(argv[idx], "--jobs", 6) == 0)
+            threads = (unsigned int)atoi(option_value(argc, argv, &idx, (argv[idx][1] == '-') ? 6 : 2));
+    return run_worker(threads);
 }
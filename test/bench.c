@@ -0,0 +1,333 @@
+/*
+ * Benchmark for Bin2C: generates synthetic input files and runs bin2c on them
+ * for a matrix of output formats, bit widths, codecs and thread counts. Each
+ * run is reported as a line of JSON (on standard output) with the throughput
+ * and the peak memory use of the bin2c process.
+ *
+ * This program uses fork() and wait4(), so it runs on Linux, macOS and the BSDs.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAX_ITEMS 32
+
+typedef struct tagLIST {
+    const char *items[MAX_ITEMS];
+    int count;
+} LIST;
+
+static void fatal(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "ERROR: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: bench [options]\n\n"
+                    "Options:\n"
+                    "  --bin2c <path>      The bin2c executable (default = ./bin2c).\n"
+                    "  --sizes <list>      Input sizes, with suffix k, M or G (default =\n"
+                    "                      1k,64k,1M,16M).\n"
+                    "  --kinds <list>      Input data: random, zero, text (default = all).\n"
+                    "  --formats <list>    Output formats (default = array,string,incbin).\n"
+                    "  --bits <list>       Bit widths for the array format (default = 8,32,64).\n"
+                    "  --codecs <list>     Codecs (default = none,bz2,deflate,lz4,zstd; codecs that\n"
+                    "                      bin2c does not support are skipped).\n"
+                    "  --jobs <list>       Thread counts (default = 1,0).\n"
+                    "  --repeat <number>   Run each case this many times, and report the fastest\n"
+                    "                      run (default = 1).\n"
+                    "  --tmpdir <path>     Directory for the generated files (default = $TMPDIR\n"
+                    "                      or /tmp).\n\n"
+                    "Lists are comma-separated. The results are on standard output, one JSON\n"
+                    "object per line.\n");
+    exit(1);
+}
+
+static void split_list(LIST *list, char *text)
+{
+    list->count = 0;
+    for (char *item = strtok(text, ","); item != NULL; item = strtok(NULL, ",")) {
+        if (list->count >= MAX_ITEMS)
+            fatal("Too many items in a list.");
+        list->items[list->count++] = item;
+    }
+}
+
+static uint64_t parse_size(const char *text)
+{
+    char *end;
+    uint64_t size = strtoull(text, &end, 10);
+    if (*end == 'k' || *end == 'K')
+        size <<= 10;
+    else if (*end == 'M')
+        size <<= 20;
+    else if (*end == 'G')
+        size <<= 30;
+    else if (*end != '\0')
+        fatal("Invalid size '%s'.", text);
+    return size;
+}
+
+/* a fast pseudo-random generator (xorshift64*), so that the inputs are the
+   same on every run */
+static uint64_t random_next(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * UINT64_C(2685821657736338717);
+}
+
+/* fill_text() fills the buffer with words and line breaks, as a stand-in for
+   source code, JSON or shader text */
+static void fill_text(uint8_t *buffer, size_t size, uint64_t *state)
+{
+    static const char *words[] = {
+        "return", "const", "int", "value", "if", "for", "(", ")", "{", "}", ";",
+        "vec4", "color", "=", "+", "0.5", "\"name\":", "\"id\":", "42,", "true,",
+        "uniform", "float", "texture", "position", "struct", "void", "main"
+    };
+    size_t pos = 0, column = 0;
+    while (pos < size) {
+        const char *word = words[random_next(state) % (sizeof words / sizeof words[0])];
+        size_t len = strlen(word);
+        for (size_t idx = 0; idx < len && pos < size; idx++)
+            buffer[pos++] = (uint8_t)word[idx];
+        column += len + 1;
+        if (pos < size)
+            buffer[pos++] = (column > 60) ? '\n' : ' ';
+        if (column > 60)
+            column = 0;
+    }
+}
+
+/* make_input() creates an input file of the given kind and size, unless it
+   already exists */
+static void make_input(const char *path, const char *kind, uint64_t size)
+{
+    struct stat st;
+    if (stat(path, &st) == 0 && (uint64_t)st.st_size == size)
+        return;
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+        fatal("Failed to create %s (%s).", path, strerror(errno));
+    const size_t blocksize = 1 << 20;
+    uint8_t *buffer = malloc(blocksize);
+    if (buffer == NULL)
+        fatal("Memory allocation error.");
+    uint64_t state = UINT64_C(0x9e3779b97f4a7c15);
+    for (uint64_t pos = 0; pos < size; pos += blocksize) {
+        size_t count = (size - pos < blocksize) ? (size_t)(size - pos) : blocksize;
+        if (strcmp(kind, "zero") == 0) {
+            memset(buffer, 0, count);
+        } else if (strcmp(kind, "text") == 0) {
+            fill_text(buffer, count, &state);
+        } else {
+            for (size_t idx = 0; idx < count; idx += 8) {
+                uint64_t value = random_next(&state);
+                memcpy(buffer + idx, &value, (count - idx < 8) ? count - idx : 8);
+            }
+        }
+        if (fwrite(buffer, 1, count, fp) != count)
+            fatal("Failed to write %s.", path);
+    }
+    free(buffer);
+    fclose(fp);
+}
+
+typedef struct tagRESULT {
+    int status;                 /* exit code of bin2c, or -1 if it crashed */
+    double seconds;
+    long peak_rss_kb;
+} RESULT;
+
+/* run() starts bin2c with the arguments and waits for it; standard output and
+   standard error of bin2c are discarded */
+static RESULT run(char *const argv[])
+{
+    RESULT result = { -1, 0.0, 0 };
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid < 0)
+        fatal("Failed to start %s.", argv[0]);
+    if (pid == 0) {
+        if (freopen("/dev/null", "w", stdout) == NULL || freopen("/dev/null", "w", stderr) == NULL)
+            _exit(127);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0)
+        fatal("Failed to wait for %s.", argv[0]);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    result.seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    result.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#if defined __APPLE__
+    result.peak_rss_kb = usage.ru_maxrss / 1024;    /* macOS reports bytes */
+#else
+    result.peak_rss_kb = usage.ru_maxrss;
+#endif
+    return result;
+}
+
+static uint64_t file_size(const char *path)
+{
+    struct stat st;
+    return (stat(path, &st) == 0) ? (uint64_t)st.st_size : 0;
+}
+
+/* codec_supported() checks whether bin2c was compiled with the codec, by
+   converting a tiny file */
+static bool codec_supported(const char *bin2c, const char *codec, const char *input,
+                            const char *output)
+{
+    char *argv[] = { (char *)bin2c, (char *)input, (char *)output, "-c", (char *)codec,
+                     "--label", "probe", NULL };
+    return run(argv).status == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *bin2c = "./bin2c";
+    const char *tmpdir = getenv("TMPDIR");
+    if (tmpdir == NULL || *tmpdir == '\0')
+        tmpdir = "/tmp";
+    char def_sizes[] = "1k,64k,1M,16M";
+    char def_kinds[] = "random,zero,text";
+    char def_formats[] = "array,string,incbin";
+    char def_bits[] = "8,32,64";
+    char def_codecs[] = "none,bz2,deflate,lz4,zstd";
+    char def_jobs[] = "1,0";
+    LIST sizes, kinds, formats, bits, codecs, jobs;
+    split_list(&sizes, def_sizes);
+    split_list(&kinds, def_kinds);
+    split_list(&formats, def_formats);
+    split_list(&bits, def_bits);
+    split_list(&codecs, def_codecs);
+    split_list(&jobs, def_jobs);
+    int repeat = 1;
+    for (int idx = 1; idx < argc; idx++) {
+        if (idx + 1 >= argc)
+            usage();
+        if (strcmp(argv[idx], "--bin2c") == 0)
+            bin2c = argv[++idx];
+        else if (strcmp(argv[idx], "--sizes") == 0)
+            split_list(&sizes, argv[++idx]);
+        else if (strcmp(argv[idx], "--kinds") == 0)
+            split_list(&kinds, argv[++idx]);
+        else if (strcmp(argv[idx], "--formats") == 0)
+            split_list(&formats, argv[++idx]);
+        else if (strcmp(argv[idx], "--bits") == 0)
+            split_list(&bits, argv[++idx]);
+        else if (strcmp(argv[idx], "--codecs") == 0)
+            split_list(&codecs, argv[++idx]);
+        else if (strcmp(argv[idx], "--jobs") == 0)
+            split_list(&jobs, argv[++idx]);
+        else if (strcmp(argv[idx], "--repeat") == 0)
+            repeat = atoi(argv[++idx]);
+        else if (strcmp(argv[idx], "--tmpdir") == 0)
+            tmpdir = argv[++idx];
+        else
+            usage();
+    }
+    if (repeat < 1)
+        repeat = 1;
+    if (access(bin2c, X_OK) != 0)
+        fatal("Cannot run %s.", bin2c);
+
+    char workdir[1024];
+    snprintf(workdir, sizeof workdir, "%s/bin2c-bench-XXXXXX", tmpdir);
+    if (mkdtemp(workdir) == NULL)
+        fatal("Failed to create a directory in %s.", tmpdir);
+    char input[1100], output[1100], probe[1100];
+    snprintf(probe, sizeof probe, "%s/probe.bin", workdir);
+    snprintf(output, sizeof output, "%s/out.h", workdir);
+    make_input(probe, "random", 64);
+
+    /* drop codecs that bin2c was not compiled with */
+    LIST available = { { NULL }, 0 };
+    for (int idx = 0; idx < codecs.count; idx++) {
+        if (codec_supported(bin2c, codecs.items[idx], probe, output))
+            available.items[available.count++] = codecs.items[idx];
+        else
+            fprintf(stderr, "Skipping codec '%s' (not supported by %s).\n", codecs.items[idx], bin2c);
+    }
+
+    for (int k = 0; k < kinds.count; k++) {
+        for (int s = 0; s < sizes.count; s++) {
+            uint64_t size = parse_size(sizes.items[s]);
+            snprintf(input, sizeof input, "%s/%s_%s.bin", workdir, kinds.items[k], sizes.items[s]);
+            make_input(input, kinds.items[k], size);
+            for (int f = 0; f < formats.count; f++) {
+                /* the string and embed formats only exist for 8-bit elements */
+                bool bytes_only = strcmp(formats.items[f], "string") == 0
+                                  || strcmp(formats.items[f], "embed") == 0;
+                for (int b = 0; b < bits.count; b++) {
+                    if (bytes_only && strcmp(bits.items[b], "8") != 0)
+                        continue;
+                    for (int c = 0; c < available.count; c++) {
+                        for (int j = 0; j < jobs.count; j++) {
+                            char *args[] = { (char *)bin2c, input, output, "--label", "bench",
+                                             "-f", (char *)formats.items[f],
+                                             "-b", (char *)bits.items[b],
+                                             "-c", (char *)available.items[c],
+                                             "-j", (char *)jobs.items[j], NULL };
+                            RESULT best = { -1, 0.0, 0 };
+                            for (int r = 0; r < repeat; r++) {
+                                RESULT result = run(args);
+                                if (r == 0 || result.seconds < best.seconds)
+                                    best.seconds = result.seconds;
+                                if (result.peak_rss_kb > best.peak_rss_kb)
+                                    best.peak_rss_kb = result.peak_rss_kb;
+                                best.status = result.status;
+                            }
+                            double mbps = (best.seconds > 0) ? (double)size / (1024.0 * 1024.0) / best.seconds : 0.0;
+                            printf("{\"kind\":\"%s\",\"size\":%" PRIu64 ",\"format\":\"%s\",\"bits\":%s,"
+                                   "\"codec\":\"%s\",\"jobs\":%s,\"status\":%d,\"seconds\":%.6f,"
+                                   "\"mb_per_s\":%.2f,\"peak_rss_kb\":%ld,\"output_bytes\":%" PRIu64 "}\n",
+                                   kinds.items[k], size, formats.items[f], bits.items[b],
+                                   available.items[c], jobs.items[j], best.status, best.seconds,
+                                   mbps, best.peak_rss_kb, file_size(output));
+                            fflush(stdout);
+                        }
+                    }
+                }
+            }
+            remove(input);
+        }
+    }
+
+    /* clean up the generated files (the incbin format creates a .S file, and
+       compressed data for incbin goes in a .blob file) */
+    remove(probe);
+    remove(output);
+    snprintf(output, sizeof output, "%s/out.S", workdir);
+    remove(output);
+    snprintf(output, sizeof output, "%s/bench.blob", workdir);
+    remove(output);
+    snprintf(output, sizeof output, "%s/probe.blob", workdir);
+    remove(output);
+    rmdir(workdir);
+    return 0;
+}
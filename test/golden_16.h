@@ -0,0 +1,14 @@
+/* generated by Bin2C */
+#include <stdint.h>
+
+const uint16_t test_array[50] = {
+	0xda00, 0x5744, 0xab62, 0xf7b4, 0x9d52, 0xc14d, 0xf761, 0x75f1, 
+	0x320b, 0x8175, 0x90f4, 0x7fad, 0x73a4, 0x231a, 0xbd60, 0x1e1b, 
+	0x7d93, 0x3db7, 0xcbc5, 0x178f, 0x8257, 0x56c8, 0x3f27, 0xa5cf, 
+	0xc9a8, 0x2407, 0x37a2, 0xd296, 0x2d63, 0x899f, 0xe3cc, 0x3ef2, 
+	0x1b22, 0xa79d, 0x269a, 0x4a3b, 0x6de7, 0x04d0, 0x95ed, 0x3117, 
+	0x870c, 0xd921, 0x0efe, 0x4ca4, 0xec34, 0x7de5, 0xc535, 0x1c84, 
+	0x38a7, 0xd0a1
+};
+
+const unsigned int test_array_size = 50;
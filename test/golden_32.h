@@ -0,0 +1,14 @@
+/* generated by Bin2C */
+#include <stdint.h>
+
+const uint32_t test_array[25] = {
+	0x5744da00, 0xf7b4ab62, 0xc14d9d52, 0x75f1f761, 
+	0x8175320b, 0x7fad90f4, 0x231a73a4, 0x1e1bbd60, 
+	0x3db77d93, 0x178fcbc5, 0x56c88257, 0xa5cf3f27, 
+	0x2407c9a8, 0xd29637a2, 0x899f2d63, 0x3ef2e3cc, 
+	0xa79d1b22, 0x4a3b269a, 0x04d06de7, 0x311795ed, 
+	0xd921870c, 0x4ca40efe, 0x7de5ec34, 0x1c84c535, 
+	0xd0a138a7
+};
+
+const unsigned int test_array_size = 25;
@@ -0,0 +1,14 @@
+/* generated by Bin2C */
+#include <stdint.h>
+
+const uint8_t test_array[100] = {
+	0x00, 0xda, 0x44, 0x57, 0x62, 0xab, 0xb4, 0xf7, 0x52, 0x9d, 0x4d, 0xc1, 0x61, 0xf7, 0xf1, 0x75, 
+	0x0b, 0x32, 0x75, 0x81, 0xf4, 0x90, 0xad, 0x7f, 0xa4, 0x73, 0x1a, 0x23, 0x60, 0xbd, 0x1b, 0x1e, 
+	0x93, 0x7d, 0xb7, 0x3d, 0xc5, 0xcb, 0x8f, 0x17, 0x57, 0x82, 0xc8, 0x56, 0x27, 0x3f, 0xcf, 0xa5, 
+	0xa8, 0xc9, 0x07, 0x24, 0xa2, 0x37, 0x96, 0xd2, 0x63, 0x2d, 0x9f, 0x89, 0xcc, 0xe3, 0xf2, 0x3e, 
+	0x22, 0x1b, 0x9d, 0xa7, 0x9a, 0x26, 0x3b, 0x4a, 0xe7, 0x6d, 0xd0, 0x04, 0xed, 0x95, 0x17, 0x31, 
+	0x0c, 0x87, 0x21, 0xd9, 0xfe, 0x0e, 0xa4, 0x4c, 0x34, 0xec, 0xe5, 0x7d, 0x35, 0xc5, 0x84, 0x1c, 
+	0xa7, 0x38, 0xa1, 0xd0
+};
+
+const unsigned int test_array_size = 100;
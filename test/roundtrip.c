@@ -0,0 +1,64 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "roundtrip_header.h"
+
+// Compares the array "data" with the file in the first argument. With
+// ROUNDTRIP_PATCH, the array is a patch (option --base), which is applied to
+// the base file in the second argument first. With ROUNDTRIP_PARTS, the data
+// is in sub-arrays (option --split).
+
+static unsigned char *read_file(const char *name, size_t *size)
+{
+    FILE *f = fopen(name, "rb");
+    assert(f != NULL);
+    fseek(f, 0, SEEK_END);
+    *size = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *buffer = malloc(*size + 1);
+    assert(buffer != NULL);
+    assert(fread(buffer, 1, *size, f) == *size);
+    fclose(f);
+    return buffer;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Expected a file name\n");
+        return 1;
+    }
+
+    size_t size;
+    unsigned char *expected = read_file(argv[1], &size);
+#if defined ROUNDTRIP_PATCH
+    assert(argc == 3);
+    size_t base_size;
+    unsigned char *base = read_file(argv[2], &base_size);
+    assert(base_size == data_size_base);
+    unsigned char *result = malloc(data_size_patched + 1);
+    assert(result != NULL);
+    assert(data_patch(result, base) == size);
+    assert(size == data_size_patched);
+    assert(memcmp(result, expected, size) == 0);
+    free(result);
+    free(base);
+#elif defined ROUNDTRIP_PARTS
+    assert(size == data_size);
+    assert(data_part_count == (size + data_part_size - 1) / data_part_size);
+    for (size_t pos = 0; pos < size; pos += data_part_size) {
+        size_t count = (size - pos < data_part_size) ? size - pos : data_part_size;
+        assert(memcmp(data_parts[pos / data_part_size], expected + pos, count) == 0);
+    }
+#else
+    assert(size == data_size);
+    assert(memcmp(data, expected, size) == 0);
+#endif
+    free(expected);
+
+    printf("Roundtrip test passed: %s\n", argv[1]);
+    return 0;
+}
@@ -27,7 +27,7 @@ main(int argc, char **argv)
         length += 2;
     }
 
-    assert(length == test_array_length);
+    assert(length == test_array_size);
     fclose(f);
 
     printf("All tests successful\n");
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Sends failing requests to Bin2C in worker mode, and checks that the worker
+# has no files open (apart from standard input, output and error) and no
+# mapping of the input file afterwards (Linux only, because of /proc).
+# usage: worker.sh <bin2c> <input file>
+bin2c=$1
+input=$2
+requests=20
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+mkfifo "$dir/requests"
+"$bin2c" --worker -j 2 < "$dir/requests" > "$dir/responses" &
+pid=$!
+exec 3> "$dir/requests"
+for id in $(seq $requests); do
+    # a missing base file fails after the input and the output file are open
+    printf '{"arguments":["%s","%s/out.h","--base","%s/missing"],"requestId":%d}\n' \
+           "$input" "$dir" "$dir" "$id" >&3
+    printf '{"arguments":["%s","%s/out.h","--sparse","--format","string"],"requestId":%d}\n' \
+           "$input" "$dir" "$id" >&3
+done
+tries=0
+while [ "$(wc -l < "$dir/responses")" -lt $((2 * requests)) ] && [ $tries -lt 100 ]; do
+    sleep 0.1
+    tries=$((tries + 1))
+done
+files=$(ls /proc/$pid/fd | wc -l)
+maps=$(grep -c "$(realpath "$input")" /proc/$pid/maps)
+exec 3>&-
+wait $pid
+if [ "$(grep -c '"exitCode":1' "$dir/responses")" -ne $((2 * requests)) ]; then
+    echo "Worker test failed: expected $((2 * requests)) failed requests"
+    exit 1
+fi
+if [ "$files" -ne 3 ] || [ "$maps" -ne 0 ]; then
+    echo "Worker test failed: $files open files, $maps mappings of $input"
+    exit 1
+fi
+echo "Worker test passed: no files left open after failed requests"